@@ -19,101 +19,149 @@
  *
  **************************************************************************
  */
+#include <mutex>
+#include <common/hash.h>
 #include "geom.h"
 
-LayoutEdgeAttrib::attrib_list *LayoutEdgeAttrib::dup (attrib_list *l, long adj)
+static struct Hashtable *_attrib_names = NULL;
+static std::mutex _attrib_lock;	// .rect files are read in parallel
+
+const char *LayoutEdgeAttrib::intern (const char *s)
 {
-  if (!l) return NULL;
-  LayoutEdgeAttrib::attrib_list *ret, *cur;
-  NEW (ret, LayoutEdgeAttrib::attrib_list);
-  ret->name = l->name;
-  ret->offset = l->offset + adj;
-  ret->next = NULL;
-  cur = ret;
-  while (l->next) {
-    NEW (cur->next, attrib_list);
-    cur = cur->next;
-    l = l->next;
-    cur->name = l->name;
-    cur->offset = l->offset + adj;
-    cur->next = NULL;
+  hash_bucket_t *b;
+  std::lock_guard<std::mutex> guard (_attrib_lock);
+
+  if (!_attrib_names) {
+    _attrib_names = hash_new (8);
   }
-  return ret;
+  b = hash_lookup (_attrib_names, s);
+  if (!b) {
+    b = hash_add (_attrib_names, s);
+  }
+  return b->key;
+}
+
+static LayoutEdgeAttrib::attrib_array *newarray (int n)
+{
+  LayoutEdgeAttrib::attrib_array *x;
+  NEW (x, LayoutEdgeAttrib::attrib_array);
+  x->ref = 1;
+  x->n = n;
+  MALLOC (x->a, LayoutEdgeAttrib::attrib_entry, n);
+  return x;
+}
+
+void LayoutEdgeAttrib::freelist (attrib_list *l)
+{
+  if (l->arr) {
+    l->arr->ref--;
+    if (l->arr->ref == 0) {
+      FREE (l->arr->a);
+      FREE (l->arr);
+    }
+  }
+  init (l);
 }
 
 /*
-  Merge y into x.
-  Both lists have to be sorted by offset.
+  Make x the markers of y, shifted by adj; the array is shared.
 */
-bool LayoutEdgeAttrib::merge (LayoutEdgeAttrib::attrib_list **x,
-			      LayoutEdgeAttrib::attrib_list *y)
+void LayoutEdgeAttrib::share (attrib_list *x, const attrib_list *y, long adj)
 {
-  if (!*x) {
-    *x = y;
+  attrib_list tmp = *y;
+
+  if (tmp.arr) {
+    /* before freelist(x), in case x and y share the array */
+    tmp.arr->ref++;
+  }
+  freelist (x);
+  *x = tmp;
+  x->adj += adj;
+}
+
+/*
+  Merge y (shifted by adj) into x, keeping offset order; a y marker
+  goes before x markers at the same offset.
+*/
+bool LayoutEdgeAttrib::merge (attrib_list *x, const attrib_list *y, long adj)
+{
+  if (y->length() == 0) {
     return true;
   }
-  attrib_list *prev, *cur;
-  prev = NULL;
-  cur = *x;
-  while (y) {
-    while (cur && cur->offset < y->offset) {
-      prev = cur;
-      cur = cur->next;
-    }
-    if (!cur) {
-      prev->next = y;
-      cur = y;
-      y = y->next;
+  if (x->length() == 0) {
+    share (x, y, adj);
+    return true;
+  }
+
+  int nx = x->length();
+  int ny = y->length();
+  attrib_array *m = newarray (nx + ny);
+  int i = 0, j = 0, k = 0;
+
+  while (i < nx || j < ny) {
+    if (j < ny && (i == nx || y->offset (j) + adj <= x->offset (i))) {
+      m->a[k].name = y->name (j);
+      m->a[k].offset = y->offset (j) + adj;
+      j++;
     }
     else {
-      if (!prev) {
-	prev = y;
-	y = y->next;
-	prev->next = cur;
-	*x = prev;
-      }
-      else {
-	prev->next = y;
-	y = y->next;
-	prev->next->next = cur;
-	prev = prev->next;
-      }
+      m->a[k].name = x->name (i);
+      m->a[k].offset = x->offset (i);
+      i++;
     }
+    k++;
   }
+  freelist (x);
+  x->arr = m;
   return true;
 }
 
-void LayoutEdgeAttrib::freelist (LayoutEdgeAttrib::attrib_list *l) {
-  LayoutEdgeAttrib::attrib_list *tmp;
-  while (l) {
-    tmp = l;
-    l = l->next;
-    FREE (tmp);
+void LayoutEdgeAttrib::add (attrib_list *x, const char *name, long offset)
+{
+  attrib_entry e;
+  attrib_array a;
+  attrib_list l;
+
+  e.name = intern (name);
+  e.offset = offset;
+
+  if (x->length() == 0) {
+    /* merge() would share the temporary array below */
+    freelist (x);
+    x->arr = newarray (1);
+    x->arr->a[0] = e;
+    return;
   }
+  a.ref = 1;
+  a.n = 1;
+  a.a = &e;
+  init (&l);
+  l.arr = &a;
+  merge (x, &l);
 }
 
-
-void LayoutEdgeAttrib::print (FILE *fp, attrib_list *l)
+void LayoutEdgeAttrib::print (FILE *fp, const attrib_list *l)
 {
-  bool out = false;
-  if (l) {
-    out = true;
+  int n = l->length();
+  if (n > 0) {
     fprintf (fp, " >[");
   }
-  while (l) {
-    fprintf (fp, " (%s %ld)", l->name, l->offset);
-    l = l->next;
+  for (int i=0; i < n; i++) {
+    fprintf (fp, " (%s %ld)", l->name (i), l->offset (i));
   }
-  if (out) {
+  if (n > 0) {
     fprintf (fp, " ]<");
   }
 }
 
 
-bool LayoutEdgeAttrib::align (attrib_list *l1, attrib_list *l2, long *amt)
+bool LayoutEdgeAttrib::align (const attrib_list *l1, const attrib_list *l2,
+			      long *amt)
 {
+  int n = l1->length();
+
   // no attributes: works with offset 0
-  if (!l1 && !l2) {
+  if (n == 0 && l2->length() == 0) {
     *amt = 0;
     return true;
   }
@@ -124,26 +172,21 @@ bool LayoutEdgeAttrib::align (attrib_list *l1, attrib_list *l2, long *amt)
   printf ("l2: "); print (stdout, l2);
   printf ("\n\n");
 #endif
-  bool shift_computed = false;
-  long shiftamt;
+  if (n != l2->length()) {
+    return false;
+  }
+
+  long shiftamt = l1->offset (0) - l2->offset (0);
 
-  while (l1 && l2) {
-    if (strcmp (l1->name, l2->name) != 0) {
+  for (int i=0; i < n; i++) {
+    /* names are interned */
+    if (l1->name (i) != l2->name (i)) {
       return false;
     }
-    if (shift_computed) {
-      if (l2->offset + shiftamt != l1->offset) {
-	return false;
-      }
-    }
-    else {
-      shiftamt = l1->offset - l2->offset;
-      shift_computed = true;
+    if (l2->offset (i) + shiftamt != l1->offset (i)) {
+      return false;
     }
-    l1 = l1->next;
-    l2 = l2->next;
   }
-  if (l1 || l2) return false;
   *amt = shiftamt;
   return true;
 }
@@ -152,71 +195,32 @@ bool LayoutEdgeAttrib::align (attrib_list *l1, attrib_list *l2, long *amt)
 LayoutEdgeAttrib *LayoutEdgeAttrib::Clone()
 {
   LayoutEdgeAttrib *ret = new LayoutEdgeAttrib();
-  if (_left) {
-    ret->_left = dup (_left);
-  }
-  if (_right) {
-    ret->_right = dup (_right);
-  }
-  if (_top) {
-    ret->_top = dup (_top);
-  }
-  if (_bot) {
-    ret->_bot = dup (_bot);
-  }
+  ret->mkCopy (*this);
   return ret;
 }
 
 
-LayoutEdgeAttrib::attrib_list *
-LayoutEdgeAttrib::flipsign (LayoutEdgeAttrib::attrib_list *x)
-{
-  if (!x) return NULL;
-  attrib_list *prev, *cur;
-  prev = NULL;
-  cur = x;
-  while (cur) {
-    attrib_list *tmp;
-
-    cur->offset = -cur->offset;
-    
-    tmp = cur->next;
-    cur->next = prev;
-    prev = cur;
-    cur = cur->next;
-  }
-  return prev;
-}
-
-void LayoutEdgeAttrib::adjust (LayoutEdgeAttrib::attrib_list *x, long adj)
-{
-  while (x) {
-    x->offset += adj;
-    x = x->next;
-  }
-}
-
 void LayoutEdgeAttrib::swaplr ()
 {
-  attrib_list *x;
+  attrib_list x;
   x = _left; _left = _right; _right = x;
   // flip sign of top/bot attribs
-  _top = flipsign (_top);
-  _bot = flipsign (_bot);
+  flipsign (&_top);
+  flipsign (&_bot);
 }
   
 void LayoutEdgeAttrib::swaptb ()
 {
-  attrib_list *x;
+  attrib_list x;
   x = _top; _top = _bot; _bot = x;
   // flip sign of left/right attrib
-  _left = flipsign (_left);
-  _right = flipsign (_right);
+  flipsign (&_left);
+  flipsign (&_right);
 }
 
 void LayoutEdgeAttrib::swap45()
 {
-  attrib_list *x;
+  attrib_list x;
   x = _left; _left = _bot; _bot = x;
   x = _right; _right = _top; _top = x;
 }
@@ -224,7 +228,7 @@ void LayoutEdgeAttrib::swap45()
 
 /*
  * Clone the attributes, and adjust coordinates based on the
- * transformation matrix
+ * transformation matrix. The clone shares the marker arrays.
  */
 LayoutEdgeAttrib *LayoutEdgeAttrib::Clone (TransformMat *m)
 {
@@ -264,14 +268,10 @@ LayoutEdgeAttrib *LayoutEdgeAttrib::Clone (TransformMat *m)
   }
 
   // now adjust list with dx and dy
-  if (dx != 0) {
-    le->adjust (_top, dx);
-    le->adjust (_bot, dx);
-  }
-  if (dy != 0) {
-    le->adjust (_left, dy);
-    le->adjust (_right, dy);
-  }
+  le->_top.adj += dx;
+  le->_bot.adj += dx;
+  le->_left.adj += dy;
+  le->_right.adj += dy;
   
   return le;
 }
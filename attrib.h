@@ -28,75 +28,98 @@ class TransformMat;
  * These are used as alignment markers. They can be used for an umber
  * of different purposes, including multi-deck gridded cells.
  *
- * **Currently only using an attrib_list of length at most 1 until we
- *   include multi-deck support**
+ * The markers on an edge are kept in an immutable array sorted by
+ * offset, shared (by reference count) between all the edges that use
+ * it. An edge views its array through a sign flip and a shift, so
+ * copying, mirroring, and translating markers does not touch the
+ * array. Marker names are interned.
  */
 class LayoutEdgeAttrib {
 public:
-  struct attrib_list {
-    const char *name;
+  struct attrib_entry {
+    const char *name;		// interned
     long offset;		// this offset is relative to assuming
 				// the bottom left corner of the
 				// actual layout bounding box is (0,0).
-    struct attrib_list *next;
   };
+
+  struct attrib_array {
+    int ref;			// # of edges using this array
+    int n;
+    struct attrib_entry *a;	// sorted by offset
+  };
+
+  /*
+   * The markers on one edge: marker i (in offset order) has offset
+   * sign*a[j].offset + adj, where j is i, or n-1-i if sign < 0.
+   */
+  struct attrib_list {
+    attrib_array *arr;
+    int sign;			// +1 or -1
+    long adj;
+
+    int length() const { return arr ? arr->n : 0; }
+    const char *name (int i) const { return arr->a[_idx(i)].name; }
+    long offset (int i) const {
+      return sign*arr->a[_idx(i)].offset + adj;
+    }
+    int _idx (int i) const { return sign < 0 ? arr->n - 1 - i : i; }
+  };
+  
 private:
 
   /* at the moment, we have the same attribute for the horizontal edge
      as the vertical edge
   */
-  attrib_list *_left, *_right, *_top, *_bot;
+  attrib_list _left, _right, _top, _bot;
 
-  attrib_list *dup (attrib_list *l, long adj = 0);
+  static void share (attrib_list *x, const attrib_list *y, long adj = 0);
 
   /*
-    Merge y into x.
-    Both lists have to be sorted by offset.
+    Merge y (shifted by adj) into x.
    */
-  bool merge (attrib_list **x, attrib_list *y);
+  static bool merge (attrib_list *x, const attrib_list *y, long adj = 0);
 
-  void freelist (attrib_list *l);
+  static void add (attrib_list *x, const char *name, long offset);
+
+  static void init (attrib_list *l) {
+    l->arr = NULL;
+    l->sign = 1;
+    l->adj = 0;
+  }
+  static void freelist (attrib_list *l);
+
+  static void flipsign (attrib_list *x) {
+    x->sign = -x->sign;
+    x->adj = -x->adj;
+  }
 
 public:
   LayoutEdgeAttrib() {
-    _left = NULL;
-    _right = NULL;
-    _top = NULL;
-    _bot = NULL;
+    init (&_left);
+    init (&_right);
+    init (&_top);
+    init (&_bot);
   }
 
   ~LayoutEdgeAttrib() {
     clear ();
   }
 
+  /* returns the interned copy of a marker name */
+  static const char *intern (const char *s);
 
   void mkCopy (LayoutEdgeAttrib &le) {
-    clearleft ();
-    clearright ();
-    cleartop ();
-    clearbot ();
-    _left = dup (le._left);
-    _right = dup (le._right);
-    _top = dup (le._top);
-    _bot = dup (le._bot);
+    share (&_left, &le._left);
+    share (&_right, &le._right);
+    share (&_top, &le._top);
+    share (&_bot, &le._bot);
   }
 
-  void clearleft() {
-    freelist (_left);
-    _left = NULL;
-  }
-  void clearright() {
-    freelist (_right);
-    _right = NULL;
-  }
-  void cleartop() {
-    freelist (_top);
-    _top = NULL;
-  }
-  void clearbot() {
-    freelist (_bot);
-    _bot = NULL;
-  }
+  void clearleft() { freelist (&_left); }
+  void clearright() { freelist (&_right); }
+  void cleartop() { freelist (&_top); }
+  void clearbot() { freelist (&_bot); }
 
   void clear () {
     clearleft();
@@ -105,12 +128,12 @@ public:
     clearbot();
   }
 
-  attrib_list *left() { return _left; }
-  attrib_list *right() { return _right; }
-  attrib_list *top() { return _top; }
-  attrib_list *bot() { return _bot; }
+  const attrib_list *left() { return &_left; }
+  const attrib_list *right() { return &_right; }
+  const attrib_list *top() { return &_top; }
+  const attrib_list *bot() { return &_bot; }
 
-  static void print (FILE *fp, attrib_list *l);
+  static void print (FILE *fp, const attrib_list *l);
   
   /* compute alignment between two sets of markers; returns amt that
      should be added to l2 to get to l1's offset */
@@ -118,45 +141,45 @@ public:
   /* XXX: when we support multiple independent attributes, we will
      need multiple shift amounts for alignment
   */
-  static bool align (attrib_list *l1, attrib_list *l2, long *amt);
+  static bool align (const attrib_list *l1, const attrib_list *l2,
+		     long *amt);
 
-  void setleft(attrib_list *x, long adj = 0) {
-    clearleft();
-    _left = dup (x, adj);
+  void setleft(const attrib_list *x, long adj = 0) { share (&_left, x, adj); }
+  void setright(const attrib_list *x, long adj = 0) { share (&_right, x, adj); }
+  void settop(const attrib_list *x, long adj = 0) { share (&_top, x, adj); }
+  void setbot(const attrib_list *x, long adj = 0) { share (&_bot, x, adj); }
+
+  bool mergeleft(const attrib_list *x, long adj = 0) {
+    return merge (&_left, x, adj);
   }
-  void setright(attrib_list *x, long adj = 0) {
-    clearright();
-    _right = dup(x, adj);
+  bool mergeright(const attrib_list *x, long adj = 0) {
+    return merge (&_right, x, adj);
   }
-  void settop(attrib_list *x, long adj = 0) {
-    cleartop();
-    _top = dup (x, adj);
+  bool mergetop(const attrib_list *x, long adj = 0) {
+    return merge (&_top, x, adj);
   }
-  void setbot(attrib_list *x, long adj = 0) {
-    clearbot();
-    _bot = dup (x, adj);
+  bool mergebot(const attrib_list *x, long adj = 0) {
+    return merge (&_bot, x, adj);
   }
 
-  bool mergeleft(attrib_list *x, long adj = 0) {
-    return merge (&_left, dup (x, adj));
+  /* add a single marker */
+  void addleft (const char *name, long offset) {
+    add (&_left, name, offset);
   }
-  bool mergeright(attrib_list *x, long adj = 0) {
-    return merge (&_right, dup (x, adj));
+  void addright (const char *name, long offset) {
+    add (&_right, name, offset);
   }
-  bool mergetop(attrib_list *x, long adj = 0) {
-    return merge (&_top, dup (x, adj));
+  void addtop (const char *name, long offset) {
+    add (&_top, name, offset);
   }
-  bool mergebot(attrib_list *x, long adj = 0) {
-    return merge (&_bot, dup (x, adj));
+  void addbot (const char *name, long offset) {
+    add (&_bot, name, offset);
   }
 
   void swaplr ();
   void swaptb ();
   void swap45();
 
-  attrib_list *flipsign (attrib_list *x);
-  void adjust (attrib_list *x, long adj);
-
   LayoutEdgeAttrib *Clone();
   LayoutEdgeAttrib *Clone (TransformMat *m);
 };
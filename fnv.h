@@ -0,0 +1,47 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_LAYOUT_FNV_H__
+#define __ACT_LAYOUT_FNV_H__
+
+/*
+ * 64-bit FNV-1a, used for the cache fingerprints. Start with
+ * FNV_INIT and fold in values one at a time.
+ */
+#define FNV_INIT 0xcbf29ce484222325UL
+
+static inline unsigned long fnv_hash (unsigned long h,
+				      const void *buf, int len)
+{
+  const unsigned char *s = (const unsigned char *)buf;
+  for (int i=0; i < len; i++) {
+    h ^= s[i];
+    h *= 0x100000001b3UL;
+  }
+  return h;
+}
+
+static inline unsigned long fnv_hash_int (unsigned long h, long v)
+{
+  return fnv_hash (h, &v, sizeof (v));
+}
+
+#endif /* __ACT_LAYOUT_FNV_H__ */
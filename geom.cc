@@ -48,6 +48,9 @@ void Layout::Init()
   else {
     _leak_adjust = 0;
   }
+
+  /* build shared tables up front, so Layout constructors only read them */
+  _initTech ();
 }
 
 #define LMAP_VIA 0
@@ -56,217 +59,139 @@ void Layout::Init()
 #define LMAP_FET 3
 
 struct layermap {
-  Layer *l;
+  int lnum;			/* -1 = base layer, else metal # */
   int etype;			/* n/p, if needed */
   int flavor;			/* flavor */
   unsigned int lcase:2;  // LMAP_<what> is it?
 };
-  
 
-Layout::Layout(netlist_t *_n)
+Technology *Layout::_tech = NULL;
+struct Hashtable *Layout::_lmap = NULL;
+Material **Layout::_base_other = NULL;
+int Layout::_nflavors = 0;
+path_info_t *Layout::_rect_inpath = NULL;
+
+static void _add_lmap (struct Hashtable *H, const char *name,
+		       int lnum, int etype, int flavor, int lcase)
 {
   struct layermap *lp;
   hash_bucket_t *b;
-  
-  Layout::Init();
-  
-  /*-- create all the layers --*/
-  Assert (Technology::T, "Initialization error");
 
-  N = _n;
-  _readrect = false;
+  NEW (lp, struct layermap);
+  lp->lnum = lnum;
+  lp->etype = etype;
+  lp->flavor = flavor;
+  lp->lcase = lcase;
 
-  lmap = hash_new (8);
+  b = hash_add (H, name);
+  b->v = lp;
+}
 
-  /* 1. base layer for diff, well, fets */
-  base = new Layer (Technology::T->poly, _n);
+static void _add_lmap_via (struct Hashtable *H, Contact *c,
+			   int lnum, int etype, int flavor)
+{
+  if (c && !hash_lookup (H, c->getName())) {
+    _add_lmap (H, c->getName(), lnum, etype, flavor, LMAP_VIA);
+  }
+}
 
-  /* 2. Also has #flavors*6 materials! */
+/*
+ * Technology-derived tables shared by all layouts: the map from .rect
+ * material names to layers, and the fet/diff/welldiff materials of
+ * the base layer. They are built once: the base layer of every layout
+ * points into _base_other, so the technology can't change afterwards.
+ */
+void Layout::_initTech ()
+{
+  Assert (Technology::T, "Initialization error");
+  
+  if (_tech) {
+    Assert (_tech == Technology::T,
+	    "Layout: technology changed after the layer tables were built");
+    return;
+  }
+  _tech = Technology::T;
+
+  _lmap = hash_new (8);
+
+  /* base layer has #flavors*6 materials! */
   int sz = config_get_table_size ("act.dev_flavors");
   Assert (sz > 0, "Hmm");
+  _nflavors = sz;
 
-  nflavors = sz;
-  nmetals = Technology::T->nmetals;
-
-  base->allocOther (sz*6);
+  MALLOC (_base_other, Material *, sz*6);
+  for (int i=0; i < sz*6; i++) {
+    _base_other[i] = NULL;
+  }
+  
   for (int i=0; i < sz; i++) {
-    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, FET_OFFSET),
-		    Technology::T->fet[EDGE_NFET][i]);
-
-    NEW (lp, struct layermap);
-    lp->l = base;
-    lp->etype = EDGE_NFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_FET;
-
-    b = hash_add (lmap, Technology::T->fet[EDGE_NFET][i]->getName());
-    b->v = lp;
-    
-    
-    base->setOther (TOTAL_OFFSET(i, EDGE_PFET, FET_OFFSET),
-		    Technology::T->fet[EDGE_PFET][i]);
-
-    NEW (lp, struct layermap);
-    lp->l = base;
-    lp->etype = EDGE_PFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_FET;
-
-    b = hash_add (lmap, Technology::T->fet[EDGE_PFET][i]->getName());
-    b->v = lp;
-
-
-    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, DIFF_OFFSET),
-		    Technology::T->diff[EDGE_NFET][i]);
-
-    NEW (lp, struct layermap);
-    lp->l = base;
-    lp->etype = EDGE_NFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_DIFF;
-
-    b = hash_add (lmap, Technology::T->diff[EDGE_NFET][i]->getName());
-    b->v = lp;
-
-    /* add via */
-    if (Technology::T->diff[EDGE_NFET][i]->getUpC()) {
-
-      if (!hash_lookup (lmap, Technology::T->diff[EDGE_NFET][i]->getUpC()->getName())) {
-	NEW (lp, struct layermap);
-	lp->l = base;
-	lp->etype = EDGE_NFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_VIA;
-
-	b = hash_add (lmap, Technology::T->diff[EDGE_NFET][i]->getUpC()->getName());
-	b->v = lp;
-      }
+    for (int j=0; j < 2; j++) {
+      _base_other[TOTAL_OFFSET(i, j, FET_OFFSET)] = Technology::T->fet[j][i];
+      _add_lmap (_lmap, Technology::T->fet[j][i]->getName(),
+		 -1, j, i, LMAP_FET);
     }
-
-    
-    base->setOther (TOTAL_OFFSET(i, EDGE_PFET, DIFF_OFFSET),
-		    Technology::T->diff[EDGE_PFET][i]);
-
-    NEW (lp, struct layermap);
-    lp->l = base;
-    lp->etype = EDGE_PFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_DIFF;
-
-    b = hash_add (lmap, Technology::T->diff[EDGE_PFET][i]->getName());
-    b->v = lp;
-
-    if (Technology::T->diff[EDGE_PFET][i]->getUpC()) {
-      if (!hash_lookup (lmap,
-			Technology::T->diff[EDGE_PFET][i]->getUpC()->getName())) {
-      
-	NEW (lp, struct layermap);
-	lp->l = base;
-	lp->etype = EDGE_PFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_VIA;
-
-	b = hash_add (lmap, Technology::T->diff[EDGE_PFET][i]->getUpC()->getName());
-	b->v = lp;
-      }
+    for (int j=0; j < 2; j++) {
+      _base_other[TOTAL_OFFSET(i, j, DIFF_OFFSET)] = Technology::T->diff[j][i];
+      _add_lmap (_lmap, Technology::T->diff[j][i]->getName(),
+		 -1, j, i, LMAP_DIFF);
+      _add_lmap_via (_lmap, Technology::T->diff[j][i]->getUpC(), -1, j, i);
     }
-
-    
-
-    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, WDIFF_OFFSET),
-		    Technology::T->welldiff[EDGE_NFET][i]);
-
-    if (Technology::T->welldiff[EDGE_NFET][i]) {
-      NEW (lp, struct layermap);
-      lp->l = base;
-      lp->etype = EDGE_NFET;
-      lp->flavor = i;
-      lp->lcase = LMAP_WDIFF;
-
-      b = hash_add (lmap, Technology::T->welldiff[EDGE_NFET][i]->getName());
-      b->v = lp;
-
-      if (Technology::T->welldiff[EDGE_NFET][i]->getUpC()) {
-	if (!hash_lookup (lmap, Technology::T->welldiff[EDGE_NFET][i]->getUpC()->getName())) {
-	  NEW (lp, struct layermap);
-	  lp->l = base;
-	  lp->etype = EDGE_NFET;
-	  lp->flavor = i;
-	  lp->lcase = LMAP_VIA;
-
-	  b = hash_add (lmap, Technology::T->welldiff[EDGE_NFET][i]->getUpC()->getName());
-	  b->v = lp;
-	}
-      }
-    }
-
-    base->setOther (TOTAL_OFFSET(i, EDGE_PFET, WDIFF_OFFSET),
-		    Technology::T->welldiff[EDGE_PFET][i]);
-
-    if (Technology::T->welldiff[EDGE_PFET][i]) {
-      NEW (lp, struct layermap);
-      lp->l = base;
-      lp->etype = EDGE_PFET;
-      lp->flavor = i;
-      lp->lcase = LMAP_WDIFF;
-
-      b = hash_add (lmap, Technology::T->welldiff[EDGE_PFET][i]->getName());
-      b->v = lp;
-
-      if (Technology::T->welldiff[EDGE_PFET][i]->getUpC()) {
-	if (!hash_lookup (lmap, Technology::T->welldiff[EDGE_PFET][i]->getUpC()->getName())) {
-	  NEW (lp, struct layermap);
-	  lp->l = base;
-	  lp->etype = EDGE_PFET;
-	  lp->flavor = i;
-	  lp->lcase = LMAP_VIA;
-
-	  b = hash_add (lmap, Technology::T->welldiff[EDGE_PFET][i]->getUpC()->getName());
-	  b->v = lp;
-	}
+    for (int j=0; j < 2; j++) {
+      _base_other[TOTAL_OFFSET(i, j, WDIFF_OFFSET)] =
+	Technology::T->welldiff[j][i];
+      if (Technology::T->welldiff[j][i]) {
+	_add_lmap (_lmap, Technology::T->welldiff[j][i]->getName(),
+		   -1, j, i, LMAP_WDIFF);
+	_add_lmap_via (_lmap, Technology::T->welldiff[j][i]->getUpC(),
+		       -1, j, i);
       }
     }
   }
 
-  Layer *prev = base;
-
-  if (!hash_lookup (lmap, Technology::T->poly->getUpC()->getName())) {
-    NEW (lp, struct layermap);
-    lp->l = base;
-    lp->etype = -1;
-    lp->flavor = 0;
-    lp->lcase = LMAP_VIA;
-
-    b = hash_add (lmap, Technology::T->poly->getUpC()->getName());
-    b->v = lp;
-  }
+  _add_lmap_via (_lmap, Technology::T->poly->getUpC(), -1, -1, 0);
 
-  MALLOC (metals, Layer *, Technology::T->nmetals);
-
-  /* create metal layers */
   for (int i=0; i < Technology::T->nmetals; i++) {
-    metals[i] = new Layer (Technology::T->metal[i], _n);
-    metals[i]->setDownLink (prev);
-    prev = metals[i];
-
     if (Technology::T->metal[i]->getUpC()) {
-      NEW (lp, struct layermap);
-      lp->l = metals[i];
-      lp->etype = -1;
-      lp->flavor = 0;
-      lp->lcase = LMAP_VIA;
-
-      b = hash_add (lmap, Technology::T->metal[i]->getUpC()->getName());
-      b->v = lp;
+      _add_lmap (_lmap, Technology::T->metal[i]->getUpC()->getName(),
+		 i, -1, 0, LMAP_VIA);
     }
   }
 
-
   _rect_inpath = NULL;
   if (config_exists ("lefdef.rect_inpath")) {
     _rect_inpath = path_init ();
     path_add (_rect_inpath, config_get_string ("lefdef.rect_inpath"));
   }
+}
+  
+
+Layout::Layout(netlist_t *_n)
+{
+  Layout::Init();
+  
+  /*-- create all the layers --*/
+  Assert (Technology::T, "Initialization error");
+  _initTech ();
+
+  N = _n;
+  _readrect = false;
+
+  nflavors = _nflavors;
+  nmetals = Technology::T->nmetals;
+
+  /* 1. base layer for diff, well, fets */
+  base = new Layer (Technology::T->poly, _n);
+  base->shareOther (_base_other, nflavors*6);
+
+  /* 2. metal layers */
+  Layer *prev = base;
+
+  MALLOC (metals, Layer *, nmetals);
+  for (int i=0; i < nmetals; i++) {
+    metals[i] = new Layer (Technology::T->metal[i], _n);
+    metals[i]->setDownLink (prev);
+    prev = metals[i];
+  }
 
   _le = new LayoutEdgeAttrib();
 }
@@ -282,13 +207,7 @@ Layout::~Layout()
     t = t->up;
     delete l;
   }
-
-  hash_free (lmap);
-
-  if (_rect_inpath) {
-    path_free (_rect_inpath);
-    _rect_inpath = NULL;
-  }
+  FREE (metals);
 
   if (_le) {
     delete _le;
@@ -428,12 +347,34 @@ int Layout::DrawVia (int num, long llx, long lly, unsigned long wx, unsigned lon
 }
 
 
+int Layout::merge (Layout *src, TransformMat *t)
+{
+  int ret;
+
+  Assert (nmetals == src->nmetals, "Layout::merge(): technology mismatch");
+  ret = base->merge (src->base, t);
+  for (int i=0; i < nmetals; i++) {
+    ret &= metals[i]->merge (src->metals[i], t);
+  }
+  return ret;
+}
+
+
 void Layout::PrintRect (FILE *fp, TransformMat *t)
 {
   base->PrintRect (fp, t);
   for (int i=0; i < nmetals; i++) {
     metals[i]->PrintRect (fp, t);
   }
+  PrintRectBoxes (fp);
+}
+
+/*
+  The sbox, abutment box, and alignment markers; these are not
+  transformed.
+*/
+void Layout::PrintRectBoxes (FILE *fp)
+{
   if (!_rbox.empty()) {
     fprintf (fp, "sbox %ld %ld %ld %ld\n", _rbox.llx(),
 	     _rbox.lly(), _rbox.urx()+1, _rbox.ury()+1);
@@ -442,7 +383,7 @@ void Layout::PrintRect (FILE *fp, TransformMat *t)
     fprintf (fp, "rect # $align %ld %ld %ld %ld\n", _abutbox.llx(),
 	     _abutbox.lly(), _abutbox.urx()+1, _abutbox.ury()+1);
   }
-  LayoutEdgeAttrib::attrib_list *l;
+  const LayoutEdgeAttrib::attrib_list *l;
   
   long x, y;
 
@@ -456,21 +397,25 @@ void Layout::PrintRect (FILE *fp, TransformMat *t)
   }
 
   if (_le) {
-    for (l = _le->left(); l; l = l->next) {
+    l = _le->left();
+    for (int i=0; i < l->length(); i++) {
       fprintf (fp, "rect $l:%s $align %ld %ld %ld %ld\n",
-	       l->name, x, l->offset, x, l->offset);
+	       l->name (i), x, l->offset (i), x, l->offset (i));
     }
-    for (l = _le->right(); l; l = l->next) {
+    l = _le->right();
+    for (int i=0; i < l->length(); i++) {
       fprintf (fp, "rect $r:%s $align %ld %ld %ld %ld\n",
-	       l->name, x, l->offset, x, l->offset);
+	       l->name (i), x, l->offset (i), x, l->offset (i));
     }
-    for (l = _le->top(); l; l = l->next) {
+    l = _le->top();
+    for (int i=0; i < l->length(); i++) {
       fprintf (fp, "rect $t:%s $align %ld %ld %ld %ld\n",
-	       l->name, l->offset, y, l->offset, y);
+	       l->name (i), l->offset (i), y, l->offset (i), y);
     }
-    for (l = _le->bot(); l; l = l->next) {
+    l = _le->bot();
+    for (int i=0; i < l->length(); i++) {
       fprintf (fp, "rect $b:%s $align %ld %ld %ld %ld\n",
-	       l->name, l->offset, y, l->offset, y);
+	       l->name (i), l->offset (i), y, l->offset (i), y);
     }
   }
 }
@@ -536,13 +481,85 @@ void Layout::ReadRect (Process *p, int raw_mode)
 }
   
 
+/* kinds of lines in a .rect file */
+#define RECT_LINE_SKIP 0
+#define RECT_LINE_RECT 1
+#define RECT_LINE_SBOX 2
+
+/*
+  Split one line of a .rect file in place. For a rectangle, *net is
+  the net name (NULL for #), *material is the material name, and r[]
+  holds llx, lly, urx, ury. For an sbox only r[] is set.
+*/
+static int rect_parse_line (char *buf, char **net, char **material, long *r)
+{
+  int offset;
+
+  offset = 0;
+  for (int bx=0; bx < 10240 && buf[bx]; bx++) {
+    if (!isspace (buf[bx])) { break; }
+    offset++;
+  }
+  if (buf[offset] == '\0') return RECT_LINE_SKIP;
+  if (strncmp (buf+offset, "inrect ", 7) == 0) {
+    offset += 7;
+  }
+  else if (strncmp (buf+offset, "outrect ", 8) == 0) {
+    offset += 8;
+  }
+  else if (strncmp (buf+offset, "rect ", 5) == 0) {
+    offset += 5;
+  }
+  else if (strncmp (buf+offset, "bbox ", 5) == 0) {
+    // this is auto-generated, so ignore it.
+    return RECT_LINE_SKIP;
+  }
+  else if (strncmp (buf+offset, "sbox ", 5) == 0) {
+    // this overrides the bbox definition, so keep it
+    sscanf (buf+offset+5, "%ld %ld %ld %ld", &r[0], &r[1], &r[2], &r[3]);
+    return RECT_LINE_SBOX;
+  }
+  else if (strncmp (buf+offset, "cell ", 5) == 0) {
+    Assert (0, "FIXME: add support for subcells!");
+    /* celltype id swap? flipx? flipy? dx dy llx lly urx ury */
+  }
+  else {
+    fatal_error ("Line: %s\nNeeds inrect, outrect, rect, bbox, sbox, or cell", buf);
+  }
+
+  if (strncmp (buf+offset, "# ", 2) == 0) {
+    *net = NULL;
+    offset += 2;
+  }
+  else {
+    *net = buf+offset;
+    while (buf[offset] && buf[offset] != ' ') {
+      offset++;
+    }
+    Assert (buf[offset], "Long line");
+    buf[offset] = '\0';
+    offset++;
+  }
+
+  *material = buf+offset;
+
+  while (buf[offset] && buf[offset] != ' ') {
+    offset++;
+  }
+  Assert (buf[offset], "Long line");
+  buf[offset] = '\0';
+  offset++;
+
+  sscanf (buf+offset, "%ld %ld %ld %ld", &r[0], &r[1], &r[2], &r[3]);
+  return RECT_LINE_RECT;
+}
+
 void Layout::ReadRect (const char *fname, int raw_mode)
 {
   FILE *fp;
   char buf[10240];
-  int rtype = 0;
-  int offset;
-  char *net;
+  char *net, *material;
+  long r[4];
   Process *p;
 
   if (raw_mode == 0 && (!N || !N->bN || !N->bN->p)) {
@@ -567,69 +584,17 @@ void Layout::ReadRect (const char *fname, int raw_mode)
 #if 0
     printf ("BUF: %s", buf);
 #endif    
-    offset = 0;
-    for (int bx=0; bx < 10240 && buf[bx]; bx++) {
-      if (!isspace (buf[bx])) { break; }
-      offset++;
-    }
-    if (buf[offset] == '\0') continue;
-    if (strncmp (buf+offset, "inrect ", 7) == 0) {
-      offset += 7;
-      rtype = 1;
-    }
-    else if (strncmp (buf+offset, "outrect ", 8) == 0) {
-      offset += 8;
-      rtype = 2;
-    }
-    else if (strncmp (buf+offset, "rect ", 5) == 0) {
-      offset += 5;
-      rtype = 0;
-    }
-    else if (strncmp (buf+offset, "bbox ", 5) == 0) {
-      // this is auto-generated, so ignore it.
+    int kind = rect_parse_line (buf, &net, &material, r);
+    if (kind == RECT_LINE_SKIP) {
       continue;
     }
-    else if (strncmp (buf+offset, "sbox ", 5) == 0) {
-      // this overrides the bbox definition, so keep it
-      long rlx, rly, rux, ruy;
-      sscanf (buf+5, "%ld %ld %ld %ld", &rlx, &rly, &rux, &ruy);
-      _rbox.setRect (rlx, rly, rux - rlx, ruy - rly);
+    if (kind == RECT_LINE_SBOX) {
+      _rbox.setRect (r[0], r[1], r[2] - r[0], r[3] - r[1]);
       continue;
     }
-    else if (strncmp (buf+offset, "cell ", 5) == 0) {
-      Assert (0, "FIXME: add support for subcells!");
-      /* celltype id swap? flipx? flipy? dx dy llx lly urx ury */
-    }
-    else {
-      fatal_error ("Line: %s\nNeeds inrect, outrect, rect, bbox, sbox, or cell", buf);
-    }
-
-    if (strncmp (buf+offset, "# ", 2) == 0) {
-      net = NULL;
-      offset += 2;
-    }
-    else {
-      net = buf+offset;
-      while (buf[offset] && buf[offset] != ' ') {
-	offset++;
-      }
-      Assert (buf[offset], "Long line");
-      buf[offset] = '\0';
-      offset++;
-    }
 
     node_t *n = NULL;
 
-    char *material;
-    material = buf+offset;
-
-    while (buf[offset] && buf[offset] != ' ') {
-      offset++;
-    }
-    Assert (buf[offset], "Long line");
-    buf[offset] = '\0';
-    offset++;
-
     if (net && (raw_mode == 0) && (strcmp (material, "$align") != 0)) {
       n = ActNetlistPass::string_to_node (N, net);
       if (!n) {
@@ -639,11 +604,14 @@ void Layout::ReadRect (const char *fname, int raw_mode)
     }
 
     long rllx, rlly, rurx, rury;
-    sscanf (buf+offset, "%ld %ld %ld %ld", &rllx, &rlly, &rurx, &rury);
+    rllx = r[0];
+    rlly = r[1];
+    rurx = r[2];
+    rury = r[3];
 
 #if 0
-    printf ("[%s] rtype=%d, net=%s, (%ld, %ld) -> (%ld, %ld)\n", material,
-	    rtype, net ? net : "-none-", rllx, rlly, rurx, rury);
+    printf ("[%s] net=%s, (%ld, %ld) -> (%ld, %ld)\n", material,
+	    net ? net : "-none-", rllx, rlly, rurx, rury);
 #endif
 
     if (rllx >= rurx || rlly >= rury) {
@@ -680,37 +648,31 @@ void Layout::ReadRect (const char *fname, int raw_mode)
       DrawPoly (rllx, rlly, rurx - rllx, rury - rlly, n);
     }
     else if (strcmp (material, "$align") == 0) {
-      LayoutEdgeAttrib::attrib_list *l;
-      NEW (l, LayoutEdgeAttrib::attrib_list);
-      l->next = NULL;
       /* alignment information! */
       if (!net) {
 	/* abutbox */
 	_abutbox.setRect (rllx, rlly, rurx - rllx, rury - rlly);
       }
       else if (strncmp (net, "$l:", 3) == 0) {
-	l->name = Strdup (net+3);
-	l->offset = rlly; // left alignment: lower left corner y coord
 	if (!_le) {
 	  _le = new LayoutEdgeAttrib();
 	}
-	_le->mergeleft (l);
+	// left alignment: lower left corner y coord
+	_le->addleft (net+3, rlly);
       }
       else if (strncmp (net, "$r:", 3) == 0) {
-	l->name = Strdup (net+3);
-	l->offset = rlly; // right alignment: lower left corner y coord
 	if (!_le) {
 	  _le = new LayoutEdgeAttrib();
 	}
-	_le->mergeright (l);
+	// right alignment: lower left corner y coord
+	_le->addright (net+3, rlly);
       }
       else if (strncmp (net, "$t:", 3) == 0) {
-	l->name = Strdup (net+3);
-	l->offset = rllx; // top alignment: lower left corner x coord
 	if (!_le) {
 	  _le = new LayoutEdgeAttrib();
 	}
-	_le->mergetop (l);
+	// top alignment: lower left corner x coord
+	_le->addtop (net+3, rllx);
 #if 0	
 	printf (" >> got top: ");
 	LayoutEdgeAttrib::print (stdout, _le->top());
@@ -718,12 +680,11 @@ void Layout::ReadRect (const char *fname, int raw_mode)
 #endif	
       }
       else if (strncmp (net, "$b:", 3) == 0) {
-	l->name = Strdup (net+3);
-	l->offset = rllx; // bot alignment: lower left corner x coord
 	if (!_le) {
 	  _le = new LayoutEdgeAttrib();
 	}
-	_le->mergebot (l);
+	// bot alignment: lower left corner x coord
+	_le->addbot (net+3, rllx);
 #if 0
 	printf (" >> got bot: ");
 	LayoutEdgeAttrib::print (stdout, _le->bot());
@@ -733,12 +694,11 @@ void Layout::ReadRect (const char *fname, int raw_mode)
       else {
 	warning ("Invalid alignment layer directive: `%s'; skipped", net);
       }
-      FREE (l); // don't free name: that gets used by the merge
     }
     else {
       struct layermap *lm;
       hash_bucket_t *b;
-      b = hash_lookup (lmap, material);
+      b = hash_lookup (_lmap, material);
       if (b) {
 	/*--- draw base layer or via ---*/
 	lm = (struct layermap *) b->v;
@@ -757,7 +717,8 @@ void Layout::ReadRect (const char *fname, int raw_mode)
 			rurx - rllx, rury - rlly, n);
 	  break;
 	case LMAP_VIA:
-	  lm->l->drawVia (rllx, rlly, rurx - rllx, rury - rlly, n, 0);
+	  (lm->lnum < 0 ? base : metals[lm->lnum])->drawVia
+	    (rllx, rlly, rurx - rllx, rury - rlly, n, 0);
 	  break;
 	default:
 	  fatal_error ("Unknown lmap lcase %d?", lm->lcase);
@@ -789,6 +750,121 @@ void Layout::ReadRect (const char *fname, int raw_mode)
   fclose (fp);
 }
 
+/*
+  Bloated bounding box of a .rect file, without building the layout.
+  Each rectangle is bloated by half the spacing rule of the material
+  it would be painted as, exactly as Layer::getBBox() does for tiles,
+  so this matches ReadRect() (raw mode) followed by getBloatBBox()
+  as long as the file paints cleanly (no overlapping rectangles that
+  make ReadRect() complain).
+*/
+void Layout::ReadRectBBox (const char *fname,
+			   long *llx, long *lly, long *urx, long *ury)
+{
+  FILE *fp;
+  char buf[10240];
+  char *net, *material;
+  long r[4];
+  long bloat;
+  int set = 0;
+  Rectangle rbox;
+
+  Layout::Init ();
+  _initTech ();
+
+  *llx = 0;
+  *lly = 0;
+  *urx = -1;
+  *ury = -1;
+
+  fp = fopen (fname, "r");
+  if (!fp) {
+    fatal_error ("Could not open `%s' rect file", fname);
+  }
+  while (fgets (buf, 10240, fp)) {
+    int kind = rect_parse_line (buf, &net, &material, r);
+    if (kind == RECT_LINE_SKIP) {
+      continue;
+    }
+    if (kind == RECT_LINE_SBOX) {
+      rbox.setRect (r[0], r[1], r[2] - r[0], r[3] - r[1]);
+      continue;
+    }
+    if (r[0] >= r[2] || r[1] >= r[3]) {
+      warning ("[%s] Empty rectangle (%ld,%ld) -> (%ld,%ld); skipped",
+	       material, r[0], r[1], r[2], r[3]);
+      continue;
+    }
+
+    bloat = -1;
+    if (material[0] == 'm' && isdigit(material[1])) {
+      int l;
+      sscanf (material+1, "%d", &l);
+      if (l < 1 || l > Technology::T->nmetals) {
+	warning ("Technology has %d metal layers; found `%s'; skipped",
+		 Technology::T->nmetals, material);
+      }
+      else {
+	bloat = Technology::T->metal[l-1]->minSpacing();
+      }
+    }
+    else if (strcmp (material, Technology::T->poly->getName()) == 0) {
+      bloat = Technology::T->poly->minSpacing();
+    }
+    else if (strcmp (material, "$align") == 0) {
+      /* no paint */
+    }
+    else {
+      hash_bucket_t *b = hash_lookup (_lmap, material);
+      if (b) {
+	struct layermap *lm = (struct layermap *) b->v;
+	switch (lm->lcase) {
+	case LMAP_DIFF:
+	case LMAP_WDIFF:
+	  bloat = Technology::T->getMaxSameDiffSpacing();
+	  break;
+	case LMAP_FET:
+	  bloat = ((FetMat *)_base_other[TOTAL_OFFSET(lm->flavor, lm->etype,
+						      FET_OFFSET)])->getSpacing(0);
+	  break;
+	default:
+	  /* vias don't contribute to the bounding box */
+	  break;
+	}
+      }
+      /* wells and unknown materials are skipped by ReadRect() */
+    }
+    if (bloat < 0) {
+      continue;
+    }
+    bloat = (bloat + 1)/2;
+
+    /* .rect upper coordinates are exclusive */
+    if (!set) {
+      *llx = r[0] - bloat;
+      *lly = r[1] - bloat;
+      *urx = r[2] - 1 + bloat;
+      *ury = r[3] - 1 + bloat;
+      set = 1;
+    }
+    else {
+      *llx = MIN (*llx, r[0] - bloat);
+      *lly = MIN (*lly, r[1] - bloat);
+      *urx = MAX (*urx, r[2] - 1 + bloat);
+      *ury = MAX (*ury, r[3] - 1 + bloat);
+    }
+  }
+  fclose (fp);
+
+  if (!rbox.empty()) {
+    /* sbox overrides the computed box */
+    *llx = rbox.llx();
+    *lly = rbox.lly();
+    *urx = rbox.urx();
+    *ury = rbox.ury();
+  }
+}
+
 
 void Layout::getBBox (long *llx, long *lly, long *urx, long *ury)
 {
@@ -908,7 +984,11 @@ list_t *Layout::search (void *net)
   
   for (int i=0; i < nmetals; i++) {
     list_t *l = metals[i]->searchMat (net);
-    if (list_isempty (l)) {
+    list_t *v = metals[i]->searchVia (net);
+
+    /* vias are marked by a repeated layer, so keep the material
+       entry (even if empty) whenever there are vias */
+    if (list_isempty (l) && list_isempty (v)) {
       list_free (l);
     }
     else {
@@ -916,13 +996,12 @@ list_t *Layout::search (void *net)
       list_append (ret, l);
     }
 
-    l = metals[i]->searchVia (net);
-    if (list_isempty (l)) {
-      list_free (l);
+    if (list_isempty (v)) {
+      list_free (v);
     }
     else {
       list_append (ret, metals[i]);
-      list_append (ret, l);
+      list_append (ret, v);
     }
   }
   return ret;
@@ -1194,6 +1273,38 @@ void Layout::propagateAllNets ()
   FREE (tl);
 }
 
+/*
+  Returns a list with alternating (Layer, listoftiles) for the
+  material and vias of every layer; a repeated layer holds vias
+*/
+list_t *Layout::searchAll ()
+{
+  list_t *ret = list_new ();
+
+  for (int i=-1; i < nmetals; i++) {
+    Layer *L = (i < 0 ? base : metals[i]);
+    list_t *l = L->allNonSpaceMat (1);
+    list_t *v = L->allNonSpaceVia ();
+
+    if (list_isempty (l) && list_isempty (v)) {
+      list_free (l);
+    }
+    else {
+      list_append (ret, L);
+      list_append (ret, l);
+    }
+
+    if (list_isempty (v)) {
+      list_free (v);
+    }
+    else {
+      list_append (ret, L);
+      list_append (ret, v);
+    }
+  }
+  return ret;
+}
+
 list_t *Layout::searchAllMetal ()
 {
   list_t *ret = list_new ();
@@ -1357,6 +1468,30 @@ void TransformMat::applyMat (const TransformMat &t)
   _dy += t._dy;
 }
 
+/*
+ *  x' = fx*x + dx (or fx*y + dx if swapped) is undone by
+ *  x = fx*(x' - dx), with the flips exchanged if swapped.
+ */
+TransformMat TransformMat::inverse () const
+{
+  TransformMat inv;
+
+  inv._swap = _swap;
+  if (_swap) {
+    inv._flipx = _flipy;
+    inv._flipy = _flipx;
+    inv._dx = _flipx ? _dy : -_dy;
+    inv._dy = _flipy ? _dx : -_dx;
+  }
+  else {
+    inv._flipx = _flipx;
+    inv._flipy = _flipy;
+    inv._dx = _flipx ? _dx : -_dx;
+    inv._dy = _flipy ? _dy : -_dy;
+  }
+  return inv;
+}
+
 Rectangle TransformMat::applyBox (const Rectangle &r) const
 {
   long llx, lly, urx, ury;
@@ -1366,23 +1501,36 @@ Rectangle TransformMat::applyBox (const Rectangle &r) const
     return ret;
   }
 
-  apply (r.llx(), r.lly(), &llx, &lly);
-  apply (r.urx(), r.ury(), &urx, &ury);
+  llx = r.llx();
+  lly = r.lly();
+  urx = r.urx();
+  ury = r.ury();
+  applyBoxes (1, &llx, &lly, &urx, &ury);
 
-  if (llx > urx) {
-    long tmp = llx;
-    llx = urx;
-    urx = tmp;
-  }
-  if (lly > ury) {
-    long tmp = lly;
-    lly = ury;
-    ury = lly;
-  }
   ret.setRect (llx, lly, urx - llx + 1, ury - lly + 1);
   return ret;
 }
 
+template<class O>
+struct xform_boxes {
+  static void run (long dx, long dy, int n,
+		   long *llx, long *lly, long *urx, long *ury) {
+    for (int i=0; i < n; i++) {
+      O::box (dx, dy, llx[i], lly[i], urx[i], ury[i]);
+    }
+  }
+};
+
+/*
+ * Each output coordinate is a single add or subtract, so the loop has
+ * no branches and the compiler can vectorize it.
+ */
+void TransformMat::applyBoxes (int n, long *llx, long *lly,
+			       long *urx, long *ury) const
+{
+  dispatch<xform_boxes> (n, llx, lly, urx, ury);
+}
+
 void TransformMat::Print (FILE *fp) const
 {
   fprintf (fp, "{");
@@ -1397,3 +1545,57 @@ void TransformMat::Print (FILE *fp) const
   }
   fprintf (fp, " dx=%ld dy=%ld }", _dx, _dy);
 }
+
+
+RectBatch::RectBatch ()
+{
+  _n = 0;
+  _max = 0;
+  _llx = NULL;
+  _lly = NULL;
+  _urx = NULL;
+  _ury = NULL;
+}
+
+RectBatch::~RectBatch ()
+{
+  if (_max > 0) {
+    FREE (_llx);
+    FREE (_lly);
+    FREE (_urx);
+    FREE (_ury);
+  }
+}
+
+void RectBatch::add (long llx, long lly, long urx, long ury)
+{
+  if (_n == _max) {
+    if (_max == 0) {
+      _max = 32;
+      MALLOC (_llx, long, _max);
+      MALLOC (_lly, long, _max);
+      MALLOC (_urx, long, _max);
+      MALLOC (_ury, long, _max);
+    }
+    else {
+      _max *= 2;
+      REALLOC (_llx, long, _max);
+      REALLOC (_lly, long, _max);
+      REALLOC (_urx, long, _max);
+      REALLOC (_ury, long, _max);
+    }
+  }
+  _llx[_n] = llx;
+  _lly[_n] = lly;
+  _urx[_n] = urx;
+  _ury[_n] = ury;
+  _n++;
+}
+
+void RectBatch::addTiles (list_t *tiles)
+{
+  for (listitem_t *li = list_first (tiles); li; li = list_next (li)) {
+    Tile *tmp = (Tile *) list_value (li);
+    add (tmp->getllx(), tmp->getlly(), tmp->geturx(), tmp->getury());
+  }
+}
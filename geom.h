@@ -30,6 +30,28 @@
 #include "attrib.h"
 
 
+/*
+ * A transform with its orientation fixed at compile time. fx/fy are
+ * the flips of the output x/y axes; with swap, output x is computed
+ * from input y and vice versa.
+ */
+template<int swap, int fx, int fy>
+struct Orient {
+  /* box with ll <= ur in, ll <= ur out */
+  static inline void box (long dx, long dy,
+			  long &llx, long &lly, long &urx, long &ury) {
+    long x0 = llx, x1 = urx, y0 = lly, y1 = ury;
+    if (swap) {
+      x0 = lly; x1 = ury;
+      y0 = llx; y1 = urx;
+    }
+    llx = fx ? dx - x1 : dx + x0;
+    urx = fx ? dx - x0 : dx + x1;
+    lly = fy ? dy - y1 : dy + y0;
+    ury = fy ? dy - y0 : dy + y1;
+  }
+};
+
 /*
  * Geometry transformation matrix
  */
@@ -52,12 +74,70 @@ public:
 
   Rectangle applyBox (const Rectangle &r) const;
 
+  /* transform n boxes in place; the result has ll <= ur */
+  void applyBoxes (int n, long *llx, long *lly, long *urx, long *ury) const;
+
+  /*
+   * Call K< Orient<...> >::run (dx, dy, args...) for the orientation
+   * of this transform, so that loops in K have no orientation
+   * branches.
+   */
+  template<template<class> class K, typename... Args>
+  void dispatch (Args... args) const {
+    switch ((_swap << 2) | (_flipx << 1) | _flipy) {
+    case 0: K< Orient<0,0,0> >::run (_dx, _dy, args...); break;
+    case 1: K< Orient<0,0,1> >::run (_dx, _dy, args...); break;
+    case 2: K< Orient<0,1,0> >::run (_dx, _dy, args...); break;
+    case 3: K< Orient<0,1,1> >::run (_dx, _dy, args...); break;
+    case 4: K< Orient<1,0,0> >::run (_dx, _dy, args...); break;
+    case 5: K< Orient<1,1,0> >::run (_dx, _dy, args...); break;
+    case 6: K< Orient<1,0,1> >::run (_dx, _dy, args...); break;
+    case 7: K< Orient<1,1,1> >::run (_dx, _dy, args...); break;
+    }
+  }
+
   void applyMat (const TransformMat &t);
 
+  /* the transform that undoes this one */
+  TransformMat inverse () const;
+
+  bool isEqual (const TransformMat &t) const {
+    return _dx == t._dx && _dy == t._dy && _flipx == t._flipx &&
+      _flipy == t._flipy && _swap == t._swap;
+  }
+
   void Print (FILE *fp) const;
 };
 
 
+/*
+ * A batch of boxes with inclusive upper coordinates (like tiles),
+ * stored as one array per coordinate so that a transform can be
+ * applied to all of them in one pass.
+ */
+class RectBatch {
+  long *_llx, *_lly, *_urx, *_ury;
+  int _n, _max;
+public:
+  RectBatch ();
+  ~RectBatch ();
+
+  void clear () { _n = 0; }
+  void add (long llx, long lly, long urx, long ury);
+  void addTiles (list_t *tiles); // list of Tile *
+
+  void apply (const TransformMat *t) {
+    if (t) { t->applyBoxes (_n, _llx, _lly, _urx, _ury); }
+  }
+
+  int length () const { return _n; }
+  long llx (int i) const { return _llx[i]; }
+  long lly (int i) const { return _lly[i]; }
+  long urx (int i) const { return _urx[i]; }
+  long ury (int i) const { return _ury[i]; }
+};
+
+
 /*
  * One abstract layer
  */
@@ -66,15 +146,17 @@ protected:
   Material *mat;		/* technology-specific
 				   information. routing material for
 				   the layer. */
-  Tile *hint;			/* tile containing 0,0 / last lookup */
+  Tile *hint;			/* tile containing 0,0 / last lookup;
+				   NULL until something is drawn */
 
   Tile *vhint;			// tile layer containing vias to the
- 				// next (upper) layer
-  
+				// next (upper) layer; NULL until used
+
   Layer *up, *down;		/* layer above and below */
   
   Material **other;	       // for the base layer, fet + diff
   int nother;
+  unsigned int other_shared:1; // 1 if other[] is not owned by the layer
 
   netlist_t *N;
 
@@ -91,6 +173,7 @@ protected:
 
   void allocOther (int sz);
   void setOther (int idx, Material *m);
+  void shareOther (Material **m, int sz); // use a read-only other[]
   void setDownLink (Layer *x);
 
   int Draw (long llx, long lly, unsigned long wx, unsigned long wy, void *net, int type = 0);
@@ -109,13 +192,17 @@ protected:
   list_t *searchMat (int attr);
   list_t *searchVia (void *net);
   list_t *searchVia (int attr);
-  list_t *allNonSpaceMat ();
+  list_t *allNonSpaceMat (int virt = 0); // virt: keep virtual diffusion
   list_t *allNonSpaceVia ();	// looks at "up" vias only
 
   void getBBox (long *llx, long *lly, long *urx, long *ury);
   void getBloatBBox (long *llx, long *lly, long *urx, long *ury);
 
   void PrintRect (FILE *fp, TransformMat *t = NULL);
+  void PrintTile (FILE *fp, Tile *t, int via,
+		  long llx, long lly, long urx, long ury);
+
+  int merge (Layer *src, TransformMat *t = NULL); // copy paint from src
 
   const char *getRouteName() {
     RoutingMat *rmat = dynamic_cast<RoutingMat *> (mat);
@@ -130,6 +217,7 @@ protected:
 
   Tile *find (long x, long y);
 
+
   friend class Layout;
 };
 
@@ -183,12 +271,21 @@ public:
   void getBloatBBox (long *llx, long *lly, long *urx, long *ury);
 
   void PrintRect (FILE *fp, TransformMat *t = NULL);
+  void PrintRectBoxes (FILE *fp); // non-tile lines of PrintRect
   void ReadRect (const char *file, int raw_mode = 0);
+
+  /* paint all of src, transformed by t, into this layout */
+  int merge (Layout *src, TransformMat *t = NULL);
   void ReadRect (Process *p, int raw_mode = 0);
 
+  /* bloated bbox of a .rect file, without building its tiles */
+  static void ReadRectBBox (const char *file,
+			    long *llx, long *lly, long *urx, long *ury);
+
   list_t *search (void *net);
   list_t *search (int attr);
   list_t *searchAllMetal ();
+  list_t *searchAll ();		// every non-space tile, with vias
 
   void propagateAllNets();
 
@@ -204,6 +301,7 @@ public:
     else { return _leak_adjust; }
   }
 
+  netlist_t *getNetlist() { return N; }
   node_t *getVdd() { return N->Vdd; }
   node_t *getGND() { return N->GND; }
 
@@ -224,16 +322,21 @@ private:
   int nflavors;
   int nmetals;
   netlist_t *N;
-  struct Hashtable *lmap;	// map from layer string to base layer
-				// name
-
-  path_info_t *_rect_inpath;	// input path for rectangles, if any
 
   static double _leak_adjust;
+
+  /* -- shared technology tables, see _initTech() -- */
+  static void _initTech ();
+  static Technology *_tech;	// technology the tables were built for
+  static struct Hashtable *_lmap; // map from layer string to layer
+  static Material **_base_other; // fet/diff/welldiff materials
+  static int _nflavors;
+  static path_info_t *_rect_inpath; // input path for rectangles, if any
 };
 
 class LayoutBlob;
 class SubcellInst;
+struct blob_search_cache;
 
 enum blob_type { BLOB_BASE,  /* some layout */
 		 BLOB_CELL,  /* subcell */
@@ -262,6 +365,72 @@ struct tile_listentry {
   TransformMat m;  /**< the coordinate transformation matrix */
   list_t *tiles;   /**< a list alternating between Layer pointer and a
 		      list of tiles  */
+  unsigned int shared:1; /**< tiles are owned by another entry, for
+			    array elements */
+};
+
+/* what a blob search/visit looks for */
+enum blob_search {
+  BLOB_SEARCH_NET,		// tiles on a net
+  BLOB_SEARCH_TYPE,		// base layer tiles of a given attribute
+  BLOB_SEARCH_METAL		// all metal tiles
+};
+
+/*
+ * Called for each tile visited: the layer, 1 if the tile is a via
+ * to the layer above, and the transform into blob coordinates.
+ */
+typedef void (*tile_visitor_t) (void *cookie, Layer *l, int via, Tile *t,
+				const TransformMat *m);
+
+/* one rectangle of a blob snapshot */
+struct blob_rect {
+  Layer *l;
+  Tile *t;			// source tile: net and attributes
+  int via;			// 1 if on the via plane of l
+  long llx, lly, urx, ury;	// transformed tile (inclusive)
+};
+
+/*
+ * Rectangles [start,end) from one tile plane of one layout. L is
+ * set on the last (possibly empty) run of each layout.
+ */
+struct blob_run {
+  int start, end;
+  Layout *L;
+};
+
+/*
+ * The flattened geometry of a final blob: every non-space tile in
+ * blob coordinates, in the order the layouts and their planes are
+ * visited, with an index of the rectangles sorted by net.
+ */
+class BlobSnapshot {
+  A_DECL (struct blob_rect, _r);
+  A_DECL (struct blob_run, _run);
+  int _start;			// first rectangle of the open run
+  int *_bynet;			// rectangles by net, then position
+
+  void _endRun (Layout *L);
+
+public:
+  BlobSnapshot ();
+  ~BlobSnapshot ();
+
+  void add (Layer *l, int via, Tile *t); // untransformed
+  void xform (int start, const TransformMat *m); // rects start.. in place
+  void endLayout (Layout *L) { _endRun (L); }
+  void done ();			// index; call after the last add()
+
+  int length () const { return A_LEN (_r); }
+  const struct blob_rect *get (int i) const { return &_r[i]; }
+
+  int numRuns () const { return A_LEN (_run); }
+  const struct blob_run *getRun (int i) const { return &_run[i]; }
+
+  /* the rectangles of net are getNet(start) .. getNet(end-1) */
+  void netRange (void *net, int *start, int *end) const;
+  const struct blob_rect *getNet (int k) const { return &_r[_bynet[k]]; }
 };
 
 
@@ -294,7 +463,16 @@ private:
 
   bool readRect;
 
+  bool _final;			// no more paint will be added
+  struct blob_search_cache *_sc; // memoized searches of a final
+				 // base blob
+  BlobSnapshot *_snap;		// flattened geometry, once frozen
+
   void _printRect (FILE *fp, TransformMat *t);
+  void _freeze (BlobSnapshot *s, TransformMat *t);
+
+  list_t *_baseSearch (blob_search kind, void *net, int type);
+  void _freeSearchCache ();
   
 public:
   LayoutBlob (blob_type type, Layout *l = NULL);
@@ -313,6 +491,21 @@ public:
 
   void markRead () { readRect = true; }
   bool getRead() { return readRect; }
+
+  /**
+   * Mark this blob and the blobs it contains as final: no more paint
+   * will be added to their layouts. Searches of final base blobs are
+   * memoized, and the tile lists are shared by all the results (so
+   * searching is not thread-safe on final blobs).
+   */
+  void finalize ();
+
+  /**
+   * Finalize the blob and return its flattened geometry. This is
+   * computed once, and used by all the exporters; the blob should
+   * not be changed afterwards.
+   */
+  const BlobSnapshot *freeze ();
   
   void PrintRect (FILE *fp, TransformMat *t = NULL);
 
@@ -336,6 +529,15 @@ public:
    */
   static LayoutBlob *delBBox (LayoutBlob *b);
 
+  /**
+   * Paint a list of base layout blobs into a single Layout, using
+   * the transforms computed when the list was composed. The list
+   * and its layouts are freed. Returns the updated blob; b is
+   * returned unchanged if it contains anything else, or any abutment
+   * information.
+   */
+  static LayoutBlob *flatten (LayoutBlob *b);
+
   /**
    * Returns a list of tiles in the layout that match the net
    *  @param net is the net pointer (a node_t)
@@ -349,12 +551,20 @@ public:
 						     // base layers
   list_t *searchAllMetal (TransformMat *m = NULL);
 
-  /* 
-   * Uses the return value from the search function and returns its
-   * bounding box
+  /**
+   * Calls fn on every tile that search() would return, without
+   * building the result lists. net is used for BLOB_SEARCH_NET, type
+   * for BLOB_SEARCH_TYPE.
+   */
+  void visitTiles (blob_search kind, void *net, int type,
+		   void *cookie, tile_visitor_t fn, TransformMat *m = NULL);
+
+  /*
+   * Bounding box of the tiles that search() would return; the upper
+   * coordinates are exclusive, and urx < llx if there are none.
    */
-  static void searchBBox (list_t *slist, long *bllx, long *blly, long *burx,
-			  long *bury);
+  void searchBBox (blob_search kind, void *net, int type, TransformMat *m,
+		   long *bllx, long *blly, long *burx, long *bury);
   static void searchFree (list_t *tiles);
 
   /**
@@ -376,19 +586,19 @@ public:
   /**
    * Alignment markers
    */
-  LayoutEdgeAttrib::attrib_list *getLeftAlign() {
+  const LayoutEdgeAttrib::attrib_list *getLeftAlign() {
     return _le->left();
   }
   
-  LayoutEdgeAttrib::attrib_list *getRightAlign() {
+  const LayoutEdgeAttrib::attrib_list *getRightAlign() {
     return _le->right();
   }
   
-  LayoutEdgeAttrib::attrib_list *getTopAlign() {
+  const LayoutEdgeAttrib::attrib_list *getTopAlign() {
     return _le->top();
   }
   
-  LayoutEdgeAttrib::attrib_list *getBotAlign() {
+  const LayoutEdgeAttrib::attrib_list *getBotAlign() {
     return _le->bot();
   }
 
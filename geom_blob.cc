@@ -21,6 +21,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <common/list.h>
 #include <act/act.h>
 #include <act/passes.h>
@@ -44,6 +45,10 @@ LayoutBlob::LayoutBlob (ExternMacro *m)
   long llx, lly, urx, ury;
   t = BLOB_MACRO;
   macro = m;
+  readRect = false;
+  _final = false;
+  _sc = NULL;
+  _snap = NULL;
   if (macro && macro->isValid()) {
     macro->getBBox (&llx, &lly, &urx, &ury);
     _bbox.setRectCoords (llx, lly, urx, ury);
@@ -64,6 +69,9 @@ LayoutBlob::LayoutBlob (blob_type type, Layout *lptr)
 {
   t = type;
   readRect = false;
+  _final = false;
+  _sc = NULL;
+  _snap = NULL;
 
   count = 0;
   
@@ -132,6 +140,9 @@ LayoutBlob::LayoutBlob (SubcellInst *cell)
   t = BLOB_CELL;
   
   readRect = false;
+  _final = false;
+  _sc = NULL;
+  _snap = NULL;
   count = 0;
 
   Assert (cell, "What?");
@@ -140,7 +151,7 @@ LayoutBlob::LayoutBlob (SubcellInst *cell)
   _bbox = cell->getBBox ();
   _bloatbbox = cell->getBloatBBox ();
   _abutbox = cell->getAbutBox ();
-  _le = cell->getLayoutEdgeAttrib ()->Clone();
+  _le = cell->getLayoutEdgeAttrib (); // already a transformed clone
 }
 
 
@@ -182,6 +193,12 @@ void LayoutBlob::appendBlob (LayoutBlob *b, blob_compose c, long gap)
 
   Assert (t == BLOB_LIST, "What?");
 
+  if (_snap) {
+    /* stale */
+    delete _snap;
+    _snap = NULL;
+  }
+
   blob_list *bl, *prev;
   NEW (bl, blob_list);
   bl->next = NULL;
@@ -211,7 +228,7 @@ void LayoutBlob::appendBlob (LayoutBlob *b, blob_compose c, long gap)
     _bbox = bl->T.applyBox (_bbox);
     _bloatbbox = bl->T.applyBox (_bloatbbox);
     _abutbox = bl->T.applyBox (_abutbox);
-    _le = bl->b->getLayoutEdgeAttrib ()->Clone();
+    _le->mkCopy (*bl->b->getLayoutEdgeAttrib ());
   }
   else {
     int do_merge_attrib = 0;
@@ -270,7 +287,7 @@ void LayoutBlob::appendBlob (LayoutBlob *b, blob_compose c, long gap)
       }
       else {
 	_abutbox.clear();
-	_le = new LayoutEdgeAttrib();
+	_le->clear ();
       }
     }
     else if (c == BLOB_VERT) {
@@ -321,7 +338,7 @@ void LayoutBlob::appendBlob (LayoutBlob *b, blob_compose c, long gap)
       }
       else {
 	_abutbox.clear();
-	_le = new LayoutEdgeAttrib();
+	_le->clear ();
       }
     }
     else if (c == BLOB_MERGE) {
@@ -445,7 +462,32 @@ void LayoutBlob::PrintRect (FILE *fp, TransformMat *mat)
 	     bloatbox.llx(), bloatbox.lly(),
 	     bloatbox.urx()+1, bloatbox.ury()+1);
   }
-  _printRect (fp, mat);
+  if (!_snap) {
+    _printRect (fp, mat);
+    return;
+  }
+
+  /* frozen: print the snapshot in the order of _printRect() */
+  RectBatch rb;
+  for (int k=0; k < _snap->numRuns(); k++) {
+    const struct blob_run *run = _snap->getRun (k);
+
+    rb.clear ();
+    for (int i=run->start; i < run->end; i++) {
+      const struct blob_rect *r = _snap->get (i);
+      rb.add (r->llx, r->lly, r->urx, r->ury);
+    }
+    rb.apply (mat);
+    for (int i=run->end-1; i >= run->start; i--) {
+      const struct blob_rect *r = _snap->get (i);
+      int j = i - run->start;
+      r->l->PrintTile (fp, r->t, r->via,
+		       rb.llx(j), rb.lly(j), rb.urx(j), rb.ury(j));
+    }
+    if (run->L) {
+      run->L->PrintRectBoxes (fp);
+    }
+  }
 }
 
 
@@ -459,8 +501,11 @@ list_t *LayoutBlob::search (void *net, TransformMat *m)
   }
   if (t == BLOB_BASE) {
     if (base.l) {
-      tiles = base.l->search (net);
+      tiles = _baseSearch (BLOB_SEARCH_NET, net, 0);
       if (list_isempty (tiles)) {
+	if (_final) {
+	  return list_new ();
+	}
 	return tiles;
       }
       else {
@@ -468,6 +513,7 @@ list_t *LayoutBlob::search (void *net, TransformMat *m)
 	NEW (tle, struct tile_listentry);
 	tle->m = tmat;
 	tle->tiles = tiles;
+	tle->shared = _final ? 1 : 0;
 	tiles = list_new ();
 	list_append (tiles, tle);
 	return tiles;
@@ -495,6 +541,9 @@ list_t *LayoutBlob::search (void *net, TransformMat *m)
       list_free (tmp);
     }
   }
+  else if (t == BLOB_CELL) {
+    tiles = subcell->search (net, m);
+  }
   else if (t == BLOB_MACRO) {
     /* nothing, macro */
     tiles = list_new ();
@@ -516,8 +565,11 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
   }
   if (t == BLOB_BASE) {
     if (base.l) {
-      tiles = base.l->search (type);
+      tiles = _baseSearch (BLOB_SEARCH_TYPE, NULL, type);
       if (list_isempty (tiles)) {
+	if (_final) {
+	  return list_new ();
+	}
 	return tiles;
       }
       else {
@@ -525,6 +577,7 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
 	NEW (tle, struct tile_listentry);
 	tle->m = tmat;
 	tle->tiles = tiles;
+	tle->shared = _final ? 1 : 0;
 	tiles = list_new ();
 	list_append (tiles, tle);
 	return tiles;
@@ -552,6 +605,9 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
       list_free (tmp);
     }
   }
+  else if (t == BLOB_CELL) {
+    tiles = subcell->search (type, m);
+  }
   else if (t == BLOB_MACRO) {
     tiles = list_new ();
   }
@@ -566,77 +622,334 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
 LayoutBlob::~LayoutBlob ()
 {
   /* XXX do something here! */
+  _freeSearchCache ();
+  if (_snap) {
+    delete _snap;
+  }
+  if (_le) {
+    delete _le;
+  }
 }
 
 
-void LayoutBlob::searchBBox (list_t *slist, long *bllx, long *blly,
-			     long *burx, long *bury)
+/*
+ * Searches of a final base blob, keyed by net, by tile attribute, and
+ * all metal. Each value is a (Layer, tile-list) list as returned by
+ * Layout::search().
+ */
+struct blob_search_cache {
+  struct pHashtable *net;
+  iHashtable *type;
+  list_t *metal;
+};
+
+static void free_layer_tiles (list_t *l)
 {
-  long wllx, wlly, wurx, wury;
-  int init = 0;
+  listitem_t *xi;
+  for (xi = list_first (l); xi; xi = list_next (xi)) {
+    xi = list_next (xi);
+    Assert (xi, "What?");
+    list_free ((list_t *) list_value (xi));
+  }
+  list_free (l);
+}
 
-  listitem_t *tli;
-  for (tli = list_first (slist); tli; tli = list_next (tli)) {
-    struct tile_listentry *tle = (struct tile_listentry *) list_value (tli);
+void LayoutBlob::finalize ()
+{
+  _final = true;
+  if (t == BLOB_LIST) {
+    for (blob_list *bl = l.hd; bl; q_step (bl)) {
+      bl->b->finalize ();
+    }
+  }
+}
 
-    /* a transform matrix + list of (layer,tile-list) pairs */
-    listitem_t *xi;
-    for (xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
-      //Layer *name = (Layer *) list_value (xi);
-      xi = list_next (xi);
-      Assert (xi, "What?");
-      
-      list_t *actual_tiles = (list_t *) list_value (xi);
-      listitem_t *ti;
+list_t *LayoutBlob::_baseSearch (blob_search kind, void *net, int type)
+{
+  Assert (t == BLOB_BASE && base.l, "What?");
 
-      for (ti = list_first (actual_tiles); ti; ti = list_next (ti)) {
-	long tllx, tlly, turx, tury;
-	Tile *tmp = (Tile *) list_value (ti);
+  if (!_final) {
+    if (kind == BLOB_SEARCH_NET) {
+      return base.l->search (net);
+    }
+    else if (kind == BLOB_SEARCH_TYPE) {
+      return base.l->search (type);
+    }
+    else {
+      return base.l->searchAllMetal ();
+    }
+  }
 
-	tle->m.apply (tmp->getllx(), tmp->getlly(), &tllx, &tlly);
-	tle->m.apply (tmp->geturx(), tmp->getury(), &turx, &tury);
+  if (!_sc) {
+    NEW (_sc, struct blob_search_cache);
+    _sc->net = NULL;
+    _sc->type = NULL;
+    _sc->metal = NULL;
+  }
+  if (kind == BLOB_SEARCH_NET) {
+    phash_bucket_t *b;
+    if (!_sc->net) {
+      _sc->net = phash_new (8);
+    }
+    b = phash_lookup (_sc->net, net);
+    if (!b) {
+      b = phash_add (_sc->net, net);
+      b->v = base.l->search (net);
+    }
+    return (list_t *) b->v;
+  }
+  else if (kind == BLOB_SEARCH_TYPE) {
+    ihash_bucket_t *b;
+    if (!_sc->type) {
+      _sc->type = ihash_new (4);
+    }
+    b = ihash_lookup (_sc->type, type);
+    if (!b) {
+      b = ihash_add (_sc->type, type);
+      b->v = base.l->search (type);
+    }
+    return (list_t *) b->v;
+  }
+  else {
+    if (!_sc->metal) {
+      _sc->metal = base.l->searchAllMetal ();
+    }
+    return _sc->metal;
+  }
+}
 
-	if (tllx > turx) {
-	  long x = tllx;
-	  tllx = turx;
-	  turx = x;
-	}
-	  
-	if (tlly > tury) {
-	  long x = tlly;
-	  tlly = tury;
-	  tury = x;
-	}
-	
-	if (!init) {
-	  wllx = tllx;
-	  wlly = tlly;
-	  wurx = turx;
-	  wury = tury;
-	  init = 1;
-	}
-	else {
-	  wllx = MIN(wllx, tllx);
-	  wlly = MIN(wlly, tlly);
-	  wurx = MAX(wurx, turx);
-	  wury = MAX(wury, tury);
-	}
+void LayoutBlob::_freeSearchCache ()
+{
+  if (!_sc) {
+    return;
+  }
+  if (_sc->net) {
+    phash_iter_t it;
+    phash_bucket_t *b;
+    phash_iter_init (_sc->net, &it);
+    while ((b = phash_iter_next (_sc->net, &it))) {
+      free_layer_tiles ((list_t *) b->v);
+    }
+    phash_free (_sc->net);
+  }
+  if (_sc->type) {
+    ihash_iter_t it;
+    ihash_bucket_t *b;
+    ihash_iter_init (_sc->type, &it);
+    while ((b = ihash_iter_next (_sc->type, &it))) {
+      free_layer_tiles ((list_t *) b->v);
+    }
+    ihash_free (_sc->type);
+  }
+  if (_sc->metal) {
+    free_layer_tiles (_sc->metal);
+  }
+  FREE (_sc);
+  _sc = NULL;
+}
+
+
+/* visit a (Layer, tile-list) list; a repeated layer holds vias */
+static void visit_layer_tiles (list_t *l, void *cookie, tile_visitor_t fn,
+			       const TransformMat *m)
+{
+  Layer *prev = NULL;
+  listitem_t *xi, *ti;
+
+  for (xi = list_first (l); xi; xi = list_next (xi)) {
+    Layer *lname = (Layer *) list_value (xi);
+    xi = list_next (xi);
+    Assert (xi, "What?");
+    
+    list_t *actual_tiles = (list_t *) list_value (xi);
+    int via = (lname == prev) ? 1 : 0;
+    for (ti = list_first (actual_tiles); ti; ti = list_next (ti)) {
+      (*fn) (cookie, lname, via, (Tile *) list_value (ti), m);
+    }
+    prev = lname;
+  }
+}
+
+void LayoutBlob::visitTiles (blob_search kind, void *net, int type,
+			     void *cookie, tile_visitor_t fn, TransformMat *m)
+{
+  TransformMat tmat;
+
+  if (m) {
+    tmat = *m;
+  }
+  switch (t) {
+  case BLOB_BASE:
+    if (base.l) {
+      /* final blobs return their memoized list */
+      list_t *l = _baseSearch (kind, net, type);
+      visit_layer_tiles (l, cookie, fn, &tmat);
+      if (!_final) {
+	free_layer_tiles (l);
       }
     }
+    break;
+
+  case BLOB_LIST:
+    for (blob_list *bl = l.hd; bl; q_step (bl)) {
+      if (m) {
+	tmat = *m;
+      }
+      else {
+	tmat.mkI();
+      }
+      tmat.applyMat (bl->T);
+      bl->b->visitTiles (kind, net, type, cookie, fn, &tmat);
+    }
+    break;
+
+  case BLOB_CELL:
+    subcell->visitTiles (kind, net, type, cookie, fn, m);
+    break;
+
+  case BLOB_MACRO:
+    break;
+  }
+}
+
+
+static void snapshot_tile (void *cookie, Layer *l, int via, Tile *t,
+			   const TransformMat *m)
+{
+  ((BlobSnapshot *) cookie)->add (l, via, t);
+}
+
+/* same walk as _printRect() */
+void LayoutBlob::_freeze (BlobSnapshot *s, TransformMat *mat)
+{
+  TransformMat tmat;
+
+  if (mat) {
+    tmat = *mat;
+  }
+  switch (t) {
+  case BLOB_BASE:
+    if (base.l) {
+      list_t *l = base.l->searchAll ();
+      int start = s->length ();
+      /* the whole layout has one transform: apply it in one pass */
+      visit_layer_tiles (l, s, snapshot_tile, &tmat);
+      s->xform (start, &tmat);
+      free_layer_tiles (l);
+      s->endLayout (base.l);
+    }
+    break;
+
+  case BLOB_LIST:
+    for (blob_list *bl = l.hd; bl; q_step (bl)) {
+      TransformMat m = tmat;
+      m.applyMat (bl->T);
+      bl->b->_freeze (s, &m);
+    }
+    break;
+
+  case BLOB_MACRO:
+    break;
+
+  case BLOB_CELL:
+    subcell->freeze (s, &tmat);
+    break;
+  }
+}
+
+const BlobSnapshot *LayoutBlob::freeze ()
+{
+  if (!_snap) {
+    finalize ();
+    _snap = new BlobSnapshot ();
+    _freeze (_snap, NULL);
+    _snap->done ();
+  }
+  return _snap;
+}
+
+/*
+ * The bounding box of a set of tiles under one transform is the
+ * transform of their untransformed bounding box. Tiles are collected
+ * untransformed, and the box is transformed and merged whenever the
+ * transform changes.
+ */
+struct bbox_visit {
+  TransformMat m;
+  int have_m;
+  long llx, lly, urx, ury;	// untransformed, under m
+  int init;
+  long wllx, wlly, wurx, wury;	// result so far
+};
+
+static void bbox_flush (struct bbox_visit *v)
+{
+  if (!v->have_m) {
+    return;
+  }
+  v->m.applyBoxes (1, &v->llx, &v->lly, &v->urx, &v->ury);
+  if (!v->init) {
+    v->wllx = v->llx;
+    v->wlly = v->lly;
+    v->wurx = v->urx;
+    v->wury = v->ury;
+    v->init = 1;
+  }
+  else {
+    v->wllx = MIN (v->wllx, v->llx);
+    v->wlly = MIN (v->wlly, v->lly);
+    v->wurx = MAX (v->wurx, v->urx);
+    v->wury = MAX (v->wury, v->ury);
   }
-  if (!init) {
+  v->have_m = 0;
+}
+
+static void bbox_tile (void *cookie, Layer *, int, Tile *tmp,
+		       const TransformMat *m)
+{
+  struct bbox_visit *v = (struct bbox_visit *) cookie;
+
+  if (v->have_m && !v->m.isEqual (*m)) {
+    bbox_flush (v);
+  }
+  if (!v->have_m) {
+    v->m = *m;
+    v->have_m = 1;
+    v->llx = tmp->getllx();
+    v->lly = tmp->getlly();
+    v->urx = tmp->geturx();
+    v->ury = tmp->getury();
+  }
+  else {
+    v->llx = MIN (v->llx, tmp->getllx());
+    v->lly = MIN (v->lly, tmp->getlly());
+    v->urx = MAX (v->urx, tmp->geturx());
+    v->ury = MAX (v->ury, tmp->getury());
+  }
+}
+
+void LayoutBlob::searchBBox (blob_search kind, void *net, int type,
+			     TransformMat *m, long *bllx, long *blly,
+			     long *burx, long *bury)
+{
+  struct bbox_visit v;
+
+  v.have_m = 0;
+  v.init = 0;
+  visitTiles (kind, net, type, &v, bbox_tile, m);
+  bbox_flush (&v);
+
+  if (!v.init) {
     *bllx = 0;
     *blly = 0;
     *burx = -1;
     *bury = -1;
   }
   else {
-    wurx ++;
-    wury ++;
-    *bllx = wllx;
-    *blly = wlly;
-    *burx = wurx;
-    *bury = wury;
+    *bllx = v.wllx;
+    *blly = v.wlly;
+    *burx = v.wurx + 1;
+    *bury = v.wury + 1;
   }
 }
 
@@ -647,6 +960,11 @@ void LayoutBlob::searchFree (list_t *slist)
   for (tli = list_first (slist); tli; tli = list_next (tli)) {
     struct tile_listentry *tle = (struct tile_listentry *) list_value (tli);
 
+    if (tle->shared) {
+      FREE (tle);
+      continue;
+    }
+
     /* a transform matrix + list of (layer,tile-list) pairs */
     listitem_t *xi;
     for (xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
@@ -710,6 +1028,40 @@ LayoutBlob *LayoutBlob::delBBox (LayoutBlob *b)
   }
 }
 
+LayoutBlob *LayoutBlob::flatten (LayoutBlob *b)
+{
+  blob_list *bl;
+  Layout *L;
+
+  if (!b || b->t != BLOB_LIST || !b->l.hd) {
+    return b;
+  }
+  for (bl = b->l.hd; bl; q_step (bl)) {
+    if (bl->b->t != BLOB_BASE || !bl->b->base.l) {
+      return b;
+    }
+    if (bl->b->base.l->readRectangles() ||
+	!bl->b->base.l->getAbutBox().empty()) {
+      return b;
+    }
+  }
+
+  L = new Layout (b->l.hd->b->base.l->getNetlist());
+  while (b->l.hd) {
+    bl = b->l.hd;
+    b->l.hd = bl->next;
+    if (!L->merge (bl->b->base.l, &bl->T)) {
+      warning ("LayoutBlob::flatten(): overlapping paint!");
+    }
+    delete bl->b->base.l;
+    delete bl->b;
+    FREE (bl);
+  }
+  b->l.tl = NULL;
+  delete b;
+  return new LayoutBlob (BLOB_BASE, L);
+}
+
 list_t *LayoutBlob::searchAllMetal (TransformMat *m)
 {
   TransformMat tmat;
@@ -720,8 +1072,11 @@ list_t *LayoutBlob::searchAllMetal (TransformMat *m)
   }
   if (t == BLOB_BASE) {
     if (base.l) {
-      tiles = base.l->searchAllMetal();
+      tiles = _baseSearch (BLOB_SEARCH_METAL, NULL, 0);
       if (list_isempty (tiles)) {
+	if (_final) {
+	  return list_new ();
+	}
 	return tiles;
       }
       else {
@@ -729,6 +1084,7 @@ list_t *LayoutBlob::searchAllMetal (TransformMat *m)
 	NEW (tle, struct tile_listentry);
 	tle->m = tmat;
 	tle->tiles = tiles;
+	tle->shared = _final ? 1 : 0;
 	tiles = list_new ();
 	list_append (tiles, tle);
 	return tiles;
@@ -756,6 +1112,9 @@ list_t *LayoutBlob::searchAllMetal (TransformMat *m)
       list_free (tmp);
     }
   }
+  else if (t == BLOB_CELL) {
+    tiles = subcell->searchAllMetal (m);
+  }
   else {
     tiles = NULL;
     fatal_error ("New blob?");
@@ -782,3 +1141,146 @@ Rectangle LayoutBlob::getAbutBox()
     return Rectangle();
   }
 }
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Blob snapshots
+ *
+ *------------------------------------------------------------------------
+ */
+BlobSnapshot::BlobSnapshot ()
+{
+  A_INIT (_r);
+  A_INIT (_run);
+  _start = 0;
+  _bynet = NULL;
+}
+
+BlobSnapshot::~BlobSnapshot ()
+{
+  A_FREE (_r);
+  A_FREE (_run);
+  if (_bynet) {
+    FREE (_bynet);
+  }
+}
+
+void BlobSnapshot::_endRun (Layout *L)
+{
+  if (_start == A_LEN (_r) && !L) {
+    return;
+  }
+  A_NEW (_run, struct blob_run);
+  A_NEXT (_run).start = _start;
+  A_NEXT (_run).end = A_LEN (_r);
+  A_NEXT (_run).L = L;
+  A_INC (_run);
+  _start = A_LEN (_r);
+}
+
+void BlobSnapshot::add (Layer *l, int via, Tile *t)
+{
+  struct blob_rect *r;
+
+  /* a new plane starts a new run */
+  if (_start < A_LEN (_r)) {
+    r = &_r[A_LEN (_r)-1];
+    if (r->l != l || r->via != via) {
+      _endRun (NULL);
+    }
+  }
+  A_NEW (_r, struct blob_rect);
+  r = &A_NEXT (_r);
+  A_INC (_r);
+  r->l = l;
+  r->t = t;
+  r->via = via;
+  r->llx = t->getllx();
+  r->lly = t->getlly();
+  r->urx = t->geturx();
+  r->ury = t->getury();
+}
+
+template<class O>
+struct xform_rects {
+  static void run (long dx, long dy, int n, struct blob_rect *r) {
+    for (int i=0; i < n; i++) {
+      O::box (dx, dy, r[i].llx, r[i].lly, r[i].urx, r[i].ury);
+    }
+  }
+};
+
+void BlobSnapshot::xform (int start, const TransformMat *m)
+{
+  m->dispatch<xform_rects> (A_LEN (_r) - start, _r + start);
+}
+
+/*
+ * Nets are ordered by node number, so that the order does not depend
+ * on where the nodes were allocated. Nodes from different netlists
+ * can share a number; those are kept apart by pointer, which only
+ * orders rectangles that no netRange() returns together.
+ */
+static int snapshot_netkey (void *net)
+{
+  return net ? ((node_t *) net)->i : -1;
+}
+
+struct snapshot_netcmp {
+  const struct blob_rect *r;
+
+  bool operator() (int a, int b) const {
+    void *na = r[a].t->getNet ();
+    void *nb = r[b].t->getNet ();
+    if (na != nb) {
+      int ka = snapshot_netkey (na);
+      int kb = snapshot_netkey (nb);
+      if (ka != kb) {
+	return ka < kb;
+      }
+      return (unsigned long) na < (unsigned long) nb;
+    }
+    return a < b;
+  }
+};
+
+void BlobSnapshot::done ()
+{
+  struct snapshot_netcmp cmp;
+
+  _endRun (NULL);
+  if (A_LEN (_r) == 0) {
+    return;
+  }
+  MALLOC (_bynet, int, A_LEN (_r));
+  for (int i=0; i < A_LEN (_r); i++) {
+    _bynet[i] = i;
+  }
+  cmp.r = _r;
+  std::sort (_bynet, _bynet + A_LEN (_r), cmp);
+}
+
+void BlobSnapshot::netRange (void *net, int *start, int *end) const
+{
+  int lo = 0, hi = A_LEN (_r);
+  int key = snapshot_netkey (net);
+
+  /* first rectangle not before net */
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    void *n = getNet (mid)->t->getNet ();
+    int k = snapshot_netkey (n);
+    if (k < key || (k == key && (unsigned long) n < (unsigned long) net)) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  *start = lo;
+  while (lo < A_LEN (_r) && getNet (lo)->t->getNet() == net) {
+    lo++;
+  }
+  *end = lo;
+}
@@ -51,10 +51,12 @@ Layer::Layer (Material *m, netlist_t *_n)
   down = NULL;
   other = NULL;
   nother = 0;
+  other_shared = 0;
   bbox = 0;
 
-  hint = new Tile();
-  vhint = new Tile();
+  /* tile planes are created on first use */
+  hint = NULL;
+  vhint = NULL;
 
   //hint->up = vhint;
   //vhint->down = hint;
@@ -79,10 +81,21 @@ void Layer::allocOther (int sz)
 
 void Layer::setOther (int idx, Material *m)
 {
+  Assert (!other_shared, "What?");
   Assert (other[idx] == NULL, "What?");
   other[idx] = m;
 }
 
+void Layer::shareOther (Material **m, int sz)
+{
+  Assert (other == NULL, "Hmm");
+  Assert (sz > 0, "Hmm");
+  other = m;
+  nother = sz;
+  other_shared = 1;
+  Assert (nother <= 64, "attr field is not big enough?");
+}
+
 void Layer::setDownLink (Layer *x)
 {
   down = x;
@@ -101,6 +114,9 @@ int Layer::drawVia (long llx, long lly, unsigned long wx, unsigned long wy,
 
   bbox = 0;
 
+  if (!vhint) {
+    vhint = new Tile();
+  }
   x = vhint->addRect (llx, lly, wx, wy);
   if (!x) return 0;
 
@@ -141,6 +157,9 @@ int Layer::Draw (long llx, long lly, unsigned long wx, unsigned long wy,
 
   bbox = 0;
 
+  if (!hint) {
+    hint = new Tile();
+  }
   x = hint->addRect (llx, lly, wx, wy);
   if (!x) return 0;
 
@@ -165,6 +184,9 @@ int Layer::DrawVirt (int flavor, int type,
 		     long llx, long lly, unsigned long wx, unsigned long wy)
 {
   bbox = 0;
+  if (!hint) {
+    hint = new Tile();
+  }
   return hint->addVirt (flavor, type, llx, lly, wx, wy);
 }
 
@@ -241,35 +263,64 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
 
   //debug_apply = 1;
   
-  hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		    l, append_nonspacetile);
+  if (hint) {
+    hint->applyTiles (MIN_VALUE, MIN_VALUE,
+		      (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		      l, append_nonspacetile);
+  }
 
   //hint->printall();
   
   //debug_apply = 0;
 
+  RectBatch rb;
+  int i;
+
+  /* tiles are printed from the tail of the list */
+  rb.addTiles (l);
+  rb.apply (t);
+  i = rb.length();
 
   while (!list_isempty (l)) {
     Tile *tmp = (Tile *) list_delete_tail (l);
+    i--;
 
-    if (tmp->virt && TILE_ATTR_ISDIFF (tmp->getAttr())) {
-      /* this is actually a space tile (virtual diff) */
-      continue;
-    }
+    PrintTile (fp, tmp, 0, rb.llx(i), rb.lly(i), rb.urx(i), rb.ury(i));
+  }    
+  list_free (l);
 
-    if (mat != Technology::T->poly && tmp->isPin()) {
-      if (TILE_ATTR_ISOUTPUT(tmp->attr)) {
-	fprintf (fp, "outrect ");
-      }
-      else {
-	fprintf (fp, "inrect ");
-      }
-    }
-    else {
-      fprintf (fp, "rect ");
-    }
+  if (vhint) {
+    l = list_new ();
+    
+    vhint->applyTiles (MIN_VALUE, MIN_VALUE,
+		       (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		       l, append_nonspacetile);
+
+    rb.clear ();
+    rb.addTiles (l);
+    rb.apply (t);
+    i = rb.length();
 
+    while (!list_isempty (l)) {
+      Tile *tmp = (Tile *) list_delete_tail (l);
+      i--;
+
+      PrintTile (fp, tmp, 1, rb.llx(i), rb.lly(i), rb.urx(i), rb.ury(i));
+    }    
+    list_free (l);
+  }
+}
+
+
+/*
+ * Print one tile of the layer in .rect format; the coordinates are
+ * the (transformed, inclusive) tile box, via is 1 for the via plane.
+ */
+void Layer::PrintTile (FILE *fp, Tile *tmp, int via,
+		       long llx, long lly, long urx, long ury)
+{
+  if (via) {
+    fprintf (fp, "rect ");
     if (tmp->net) {
       dump_node (fp, N, (node_t *)tmp->net);
     }
@@ -277,138 +328,94 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
       fprintf (fp, "#");
     }
 
-    if ((tmp->virt && TILE_ATTR_ISFET(tmp->getAttr()))) {
-      fprintf (fp, " %s", mat->getName());
-    }
-    else if (TILE_ATTR_ISROUTE(tmp->getAttr()) || (nother == 0)) {
-      fprintf (fp, " %s", mat->getName());
+    if (nother == 0) {
+      fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
     }
     else {
-      fprintf (fp, " %s", other[TILE_ATTR_NONPOLY(tmp->getAttr())]->getName());
+      // we need to look at what is below
+      Tile *dn;
+      dn = find (tmp->getllx(), tmp->getlly());
+      if (dn->isSpace() || TILE_ATTR_ISROUTE(dn->getAttr())) {
+	fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
+      }
+      else {
+	Assert (TILE_ATTR_NONPOLY(dn->getAttr()) < nother, "What?");
+	Material *tm = other[TILE_ATTR_NONPOLY(dn->getAttr())];
+	fprintf (fp, " %s", ((DiffMat *)tm)->getUpC()->getName());
+      }
     }
-    
-    long llx, lly, urx, ury;
 
-    if (t) {
-      t->apply (tmp->getllx(), tmp->getlly(), &llx, &lly);
-      t->apply (tmp->geturx(), tmp->getury(), &urx, &ury);
+    fprintf (fp, " %ld %ld %ld %ld\n", llx, lly, urx+1, ury+1);
+    return;
+  }
 
-      if (llx > urx) {
-	long x = llx;
-	llx = urx;
-	urx = x;
-      }
-      if (lly > ury) {
-	long x = lly;
-	lly = ury;
-	ury = x;
-      }
+  if (tmp->virt && TILE_ATTR_ISDIFF (tmp->getAttr())) {
+    /* this is actually a space tile (virtual diff) */
+    return;
+  }
+
+  if (mat != Technology::T->poly && tmp->isPin()) {
+    if (TILE_ATTR_ISOUTPUT(tmp->attr)) {
+      fprintf (fp, "outrect ");
     }
     else {
-      llx = tmp->getllx();
-      lly = tmp->getlly();
-      urx = tmp->geturx();
-      ury = tmp->getury();
+      fprintf (fp, "inrect ");
     }
-    
-    fprintf (fp, " %ld %ld %ld %ld", llx, lly, urx+1, ury+1);
-
-    /*-- now if there is a fet to the right or the left then print it! --*/
-    if (tmp->net) {
-      Tile *tllx, *turx;
-      int fet_left, fet_right;
-      tllx = tmp->llxTile();
-      turx = tmp->urxTile();
-      
-      if (tllx && !tllx->isSpace() && TILE_ATTR_ISFET (tllx->getAttr())) {
-	fet_left = 1;
-      }
-      else {
-	fet_left = 0;
-      }
-      if (turx && !turx->isSpace() && TILE_ATTR_ISFET (turx->getAttr())) {
-	fet_right = 1;
-      }
-      else {
-	fet_right = 0;
-      }
+  }
+  else {
+    fprintf (fp, "rect ");
+  }
 
-      if (fet_left && fet_right) {
-	fprintf (fp, " center");
-      }
-      else if (fet_right) {
-	fprintf (fp, " left");
-      }
-      else if (fet_left) {
-	fprintf (fp, " right");
-      }
-    }
-    fprintf (fp, "\n");
-  }    
-  list_free (l);
+  if (tmp->net) {
+    dump_node (fp, N, (node_t *)tmp->net);
+  }
+  else {
+    fprintf (fp, "#");
+  }
 
-  if (vhint) {
-    l = list_new ();
+  if ((tmp->virt && TILE_ATTR_ISFET(tmp->getAttr()))) {
+    fprintf (fp, " %s", mat->getName());
+  }
+  else if (TILE_ATTR_ISROUTE(tmp->getAttr()) || (nother == 0)) {
+    fprintf (fp, " %s", mat->getName());
+  }
+  else {
+    fprintf (fp, " %s", other[TILE_ATTR_NONPOLY(tmp->getAttr())]->getName());
+  }
     
-    vhint->applyTiles (MIN_VALUE, MIN_VALUE,
-		       (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		       l, append_nonspacetile);
-
-    while (!list_isempty (l)) {
-      Tile *tmp = (Tile *) list_delete_tail (l);
-
-      fprintf (fp, "rect ");
-      if (tmp->net) {
-	dump_node (fp, N, (node_t *)tmp->net);
-      }
-      else {
-	fprintf (fp, "#");
-      }
-
-      if (nother == 0) {
-	fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
-      }
-      else {
-	// we need to look at what is below
-	Tile *dn;
-	dn = find (tmp->getllx(), tmp->getlly());
-	if (dn->isSpace() || TILE_ATTR_ISROUTE(dn->getAttr())) {
-	  fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
-	}
-	else {
-	  Assert (TILE_ATTR_NONPOLY(dn->getAttr()) < nother, "What?");
-	  Material *tm = other[TILE_ATTR_NONPOLY(dn->getAttr())];
-	  fprintf (fp, " %s", ((DiffMat *)tm)->getUpC()->getName());
-	}
-      }
+  fprintf (fp, " %ld %ld %ld %ld", llx, lly, urx+1, ury+1);
+
+  /*-- now if there is a fet to the right or the left then print it! --*/
+  if (tmp->net) {
+    Tile *tllx, *turx;
+    int fet_left, fet_right;
+    tllx = tmp->llxTile();
+    turx = tmp->urxTile();
+      
+    if (tllx && !tllx->isSpace() && TILE_ATTR_ISFET (tllx->getAttr())) {
+      fet_left = 1;
+    }
+    else {
+      fet_left = 0;
+    }
+    if (turx && !turx->isSpace() && TILE_ATTR_ISFET (turx->getAttr())) {
+      fet_right = 1;
+    }
+    else {
+      fet_right = 0;
+    }
 
-      long llx, lly, urx, ury;
-
-      if (t) {
-	t->apply (tmp->getllx(), tmp->getlly(), &llx, &lly);
-	t->apply (tmp->geturx(), tmp->getury(), &urx, &ury);
-
-	if (llx > urx) {
-	  long x = llx;
-	  llx = urx;
-	  urx = x;
-	}
-	if (lly > ury) {
-	  long x = lly;
-	  lly = ury;
-	  ury = x;
-	}
-      }
-      else {
-	llx = tmp->getllx();
-	lly = tmp->getlly();
-	urx = tmp->geturx();
-	ury = tmp->getury();
-      }
-      fprintf (fp, " %ld %ld %ld %ld\n", llx, lly, urx+1, ury+1);
-    }    
-    list_free (l);
+    if (fet_left && fet_right) {
+      fprintf (fp, " center");
+    }
+    else if (fet_right) {
+      fprintf (fp, " left");
+    }
+    else if (fet_left) {
+      fprintf (fp, " right");
+    }
   }
+  fprintf (fp, "\n");
 }
 
 
@@ -442,9 +449,11 @@ void Layer::getBBox (long *llx, long *lly, long *urx, long *ury)
 
   l = list_new ();
   
-  hint->applyTiles (MIN_VALUE+1, MIN_VALUE+1,
-		    (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		    l, append_nonspacetile);
+  if (hint) {
+    hint->applyTiles (MIN_VALUE+1, MIN_VALUE+1,
+		      (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		      l, append_nonspacetile);
+  }
 
   xllx = 0;
   xlly = 0;
@@ -544,71 +553,98 @@ void Layer::getBBox (long *llx, long *lly, long *urx, long *ury)
 }
 
 
-static void *_searchnet = NULL;
+/* search state, passed as the cookie so that searches are reentrant */
+struct layer_search {
+  list_t *l;
+  void *net;
+  int type;
+};
+
 static void appendnet (void *cookie, Tile *t)
 {
-  list_t *l = (list_t *)cookie;
-  if (t->getNet () == _searchnet) {
-    list_append (l, t);
+  struct layer_search *s = (struct layer_search *)cookie;
+  if (t->getNet () == s->net) {
+    list_append (s->l, t);
   }
 }
 
-static int _searchtype = -1;
 static void appendtype (void *cookie, Tile *t)
 {
-  list_t *l = (list_t *)cookie;
-  if (t->getAttr() == _searchtype) {
-    list_append (l, t);
+  struct layer_search *s = (struct layer_search *)cookie;
+  if (t->getAttr() == s->type) {
+    list_append (s->l, t);
   }
 }
 
 list_t *Layer::searchMat (void *net)
 {
-  list_t *l = list_new ();
-  _searchnet = net;
+  struct layer_search s;
+  s.l = list_new ();
+
+  if (!hint) {
+    return s.l;
+  }
+  s.net = net;
   hint->applyTiles (MIN_VALUE, MIN_VALUE,
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendnet);
-  _searchnet = NULL;
-  return l;
+		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), &s, appendnet);
+  return s.l;
 }
 
 list_t *Layer::searchMat (int type)
 {
-  list_t *l = list_new ();
-  _searchtype = type;
+  struct layer_search s;
+  s.l = list_new ();
+
+  if (!hint) {
+    return s.l;
+  }
+  s.type = type;
   hint->applyTiles (MIN_VALUE, MIN_VALUE,
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendtype);
-  return l;
+		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), &s, appendtype);
+  return s.l;
 }
 
 list_t *Layer::searchVia (void *net)
 {
-  list_t *l = list_new ();
-  _searchnet = net;
+  struct layer_search s;
+  s.l = list_new ();
+
+  if (!vhint) {
+    return s.l;
+  }
+  s.net = net;
   vhint->applyTiles (MIN_VALUE, MIN_VALUE,
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendnet);
-  _searchnet = NULL;
-  return l;
+		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), &s, appendnet);
+  return s.l;
 }
 
 list_t *Layer::searchVia (int type)
 {
-  list_t *l = list_new ();
-  _searchtype = type;
+  struct layer_search s;
+  s.l = list_new ();
+
+  if (!vhint) {
+    return s.l;
+  }
+  s.type = type;
   vhint->applyTiles (MIN_VALUE, MIN_VALUE,
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendtype);
-  return l;
+		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), &s, appendtype);
+  return s.l;
 }
 
-list_t *Layer::allNonSpaceMat ()
+list_t *Layer::allNonSpaceMat (int virt)
 {
   list_t *l = list_new ();
 
-  if (isMetal()) {
+  if (!hint) {
+    return l;
+  }
+
+  if (isMetal() || virt) {
     hint->applyTiles (MIN_VALUE, MIN_VALUE,
 		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
 		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
@@ -626,6 +662,10 @@ list_t *Layer::allNonSpaceMat ()
 list_t *Layer::allNonSpaceVia ()
 {
   list_t *l = list_new ();
+
+  if (!vhint) {
+    return l;
+  }
   vhint->applyTiles (MIN_VALUE, MIN_VALUE,
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
 		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
@@ -634,8 +674,104 @@ list_t *Layer::allNonSpaceVia ()
 }
 
 
+/*
+  Transform a tile into the coordinate system of t
+*/
+static void xform_tile (TransformMat *t, Tile *x,
+			long *llx, long *lly, unsigned long *wx,
+			unsigned long *wy)
+{
+  long tllx, tlly, turx, tury;
+
+  if (t) {
+    t->apply (x->getllx(), x->getlly(), &tllx, &tlly);
+    t->apply (x->geturx(), x->getury(), &turx, &tury);
+  }
+  else {
+    tllx = x->getllx();
+    tlly = x->getlly();
+    turx = x->geturx();
+    tury = x->getury();
+  }
+  if (tllx > turx) {
+    long tmp = tllx;
+    tllx = turx;
+    turx = tmp;
+  }
+  if (tlly > tury) {
+    long tmp = tlly;
+    tlly = tury;
+    tury = tmp;
+  }
+  *llx = tllx;
+  *lly = tlly;
+  *wx = turx - tllx + 1;
+  *wy = tury - tlly + 1;
+}
+
+/*
+  Paint all the material and vias of src (transformed by t) into this
+  layer. Returns 0 if some of it conflicted with existing paint.
+*/
+int Layer::merge (Layer *src, TransformMat *t)
+{
+  list_t *l;
+  listitem_t *li;
+  long llx, lly;
+  unsigned long wx, wy;
+  int ret = 1;
+
+  if (src->hint) {
+    l = list_new ();
+    src->hint->applyTiles (MIN_VALUE, MIN_VALUE,
+			   (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
+			   (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
+			   append_nonspacetile);
+    /* real paint first; virtual fets are drawn as poly */
+    for (li = list_first (l); li; li = list_next (li)) {
+      Tile *x = (Tile *) list_value (li);
+      xform_tile (t, x, &llx, &lly, &wx, &wy);
+      if (!x->isVirt()) {
+	ret &= Draw (llx, lly, wx, wy, x->getNet(), x->getAttr());
+      }
+      else if (TILE_ATTR_ISFET (x->getAttr())) {
+	ret &= Draw (llx, lly, wx, wy, x->getNet(), 0);
+      }
+    }
+    /* ... and then the virtual diffusion/fets on top */
+    for (li = list_first (l); li; li = list_next (li)) {
+      Tile *x = (Tile *) list_value (li);
+      if (!x->isVirt()) continue;
+      xform_tile (t, x, &llx, &lly, &wx, &wy);
+      ret &= DrawVirt (TILE_ATTR_TO_FLAV (x->getAttr()),
+		       TILE_ATTR_TO_TYPE (x->getAttr()), llx, lly, wx, wy);
+    }
+    list_free (l);
+  }
+
+  if (src->vhint) {
+    l = list_new ();
+    src->vhint->applyTiles (MIN_VALUE, MIN_VALUE,
+			    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
+			    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
+			    append_nonspacetile);
+    for (li = list_first (l); li; li = list_next (li)) {
+      Tile *x = (Tile *) list_value (li);
+      xform_tile (t, x, &llx, &lly, &wx, &wy);
+      ret &= drawVia (llx, lly, wx, wy, x->getNet(), x->getAttr());
+    }
+    list_free (l);
+  }
+  return ret;
+}
+
+
 Tile *Layer::find (long llx, long lly)
 {
+  if (!hint) {
+    /* empty plane: a single space tile */
+    hint = new Tile();
+  }
   return hint->find (llx, lly);
 }
 
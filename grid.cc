@@ -0,0 +1,50 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <common/misc.h>
+#include "grid.h"
+
+void GridSnap::setPitch (unsigned long pitch)
+{
+  Assert (pitch > 0, "GridSnap: zero pitch!");
+  _pitch = pitch;
+  _pow2 = ((pitch & (pitch - 1)) == 0) ? 1 : 0;
+  if (!_pow2 && pitch <= 0xffffffffUL) {
+    _recip = ~0UL / pitch + 1;
+  }
+  else {
+    _recip = 0;
+  }
+}
+
+void GridSnap::up (long *w, int n) const
+{
+  for (int i=0; i < n; i++) {
+    w[i] = up (w[i]);
+  }
+}
+
+void GridSnap::dn (long *w, int n) const
+{
+  for (int i=0; i < n; i++) {
+    w[i] = dn (w[i]);
+  }
+}
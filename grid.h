@@ -0,0 +1,86 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_LAYOUT_GRID_H__
+#define __ACT_LAYOUT_GRID_H__
+
+/*
+ * Snap coordinates to a fixed pitch.
+ *
+ * The pitch is fixed up front, so the remainder computation uses a
+ * precomputed reciprocal (a multiply instead of a divide) whenever the
+ * coordinate fits in 32 bits, and a mask for power-of-two pitches.
+ */
+class GridSnap {
+public:
+  GridSnap (unsigned long pitch = 1) { setPitch (pitch); }
+
+  void setPitch (unsigned long pitch);
+  unsigned long getPitch () const { return _pitch; }
+
+  /* smallest multiple of the pitch >= w */
+  long up (long w) const {
+    unsigned long u, r;
+    if (w >= 0) {
+      r = _mod (w);
+      return r ? w + (long)(_pitch - r) : w;
+    }
+    u = -w;
+    r = _mod (u);
+    return r ? -(long)(u - r) : w;
+  }
+
+  /* largest multiple of the pitch <= w */
+  long dn (long w) const {
+    unsigned long u, r;
+    if (w >= 0) {
+      return w - (long)_mod (w);
+    }
+    u = -w;
+    r = _mod (u);
+    return r ? -(long)(u - r + _pitch) : w;
+  }
+
+  /* snap n coordinates in place */
+  void up (long *w, int n) const;
+  void dn (long *w, int n) const;
+
+private:
+  unsigned long _pitch;
+  unsigned int _pow2:1;		// 1 if the pitch is a power of two
+  unsigned long _recip;		// ceil(2^64/pitch), 0 if unused
+
+  unsigned long _mod (unsigned long w) const {
+    if (_pow2) {
+      return w & (_pitch - 1);
+    }
+#ifdef __SIZEOF_INT128__
+    if (_recip && w <= 0xffffffffUL) {
+      /* remainder from the fractional part of w/pitch */
+      unsigned long frac = _recip * w;
+      return (unsigned long)(((unsigned __int128)frac * _pitch) >> 64);
+    }
+#endif
+    return w % _pitch;
+  }
+};
+
+#endif /* __ACT_LAYOUT_GRID_H__ */
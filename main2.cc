@@ -20,10 +20,82 @@
  **************************************************************************
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include "stk_layout.h"
 
+static void usage (char *name)
+{
+  fprintf (stderr, "Usage: %s [-j <threads>] [-F] [-r] <actfile> <rectfile|dir> ...\n", name);
+  fprintf (stderr, " -j <threads>: number of files to read in parallel (default: # of cores)\n");
+  fprintf (stderr, " -F : build the full layout for each file instead of scanning it\n");
+  fprintf (stderr, " -r : print the bloated bbox as read, without snapping it to the grid\n");
+  fprintf (stderr, "With a single .rect file, prints its bbox; otherwise prints a table with\none line per .rect file (directories are scanned for .rect files).\n");
+  exit (1);
+}
+
+static int strcmp_ptr (const void *a, const void *b)
+{
+  return strcmp (*(char **)a, *(char **)b);
+}
+
+/* append all the .rect files in dir to l, in sorted order */
+static void add_dir (list_t *l, const char *dir)
+{
+  DIR *d;
+  struct dirent *de;
+  int len;
+  A_DECL (char *, names);
+
+  d = opendir (dir);
+  if (!d) {
+    fatal_error ("Could not open directory `%s'", dir);
+  }
+  A_INIT (names);
+  while ((de = readdir (d))) {
+    len = strlen (de->d_name);
+    if (len > 5 && strcmp (de->d_name + len - 5, ".rect") == 0) {
+      A_NEW (names, char *);
+      MALLOC (A_NEXT (names), char, strlen (dir) + len + 2);
+      sprintf (A_NEXT (names), "%s/%s", dir, de->d_name);
+      A_INC (names);
+    }
+  }
+  closedir (d);
+  qsort (names, A_LEN (names), sizeof (char *), strcmp_ptr);
+  for (int i=0; i < A_LEN (names); i++) {
+    list_append (l, names[i]);
+  }
+  A_FREE (names);
+}
+
+static int full_layout = 0;
+
+static void rect_bbox (const char *file,
+		       long *llx, long *lly, long *urx, long *ury)
+{
+  if (!full_layout) {
+    Layout::ReadRectBBox (file, llx, lly, urx, ury);
+    return;
+  }
+  Layout *l = new Layout (NULL);
+  l->ReadRect (file, 1);
+  l->getBloatBBox (llx, lly, urx, ury);
+  delete l;
+}
+
 int main (int argc, char **argv)
 {
+  int ch;
+  int nthreads = 0;
+  int raw = 0;
+
   Act::Init (&argc, &argv, "layout:layout.conf");
   {
     char *tmpfile = config_file_name ("macros.conf");
@@ -32,35 +104,123 @@ int main (int argc, char **argv)
       config_read ("macros.conf");
     }
   }
+
+  while ((ch = getopt (argc, argv, "j:Fr")) != -1) {
+    switch (ch) {
+    case 'F':
+      full_layout = 1;
+      break;
+
+    case 'r':
+      raw = 1;
+      break;
+
+    case 'j':
+      nthreads = atoi (optarg);
+      if (nthreads < 1) {
+	usage (argv[0]);
+      }
+      break;
+
+    default:
+      usage (argv[0]);
+      break;
+    }
+  }
   
-  if (argc != 3) {
-    fatal_error ("Usage: %s <actfile> <rectfile>\n", argv[0]);
+  if (argc - optind < 2) {
+    usage (argv[0]);
   }
 
-  Act *a = new Act (argv[1]);
+  Act *a = new Act (argv[optind]);
 
   new ActNetlistPass (a);
   new ActDynamicPass (a, "net2stk", "pass_stk.so", "stk");
   ActDynamicPass *dp = new ActDynamicPass(a, "stk2layout", "pass_layout.so", "layout");
 
-  Layout *l = new Layout (NULL);
-  l->ReadRect (argv[2], 1);
-
   ActStackLayout *lp = (ActStackLayout *)dp->getPtrParam ("raw");
-  
-  long llx, lly, urx, ury;
 
-  /* NOTE: this has to be kept consistent with computeLEFboundary */
-  l->getBloatBBox (&llx, &lly, &urx, &ury);
-  
   Assert (Technology::T->nmetals >= 3, "Hmm");
 
-  llx = lp->snap_dn_x (llx);
-  urx = lp->snap_up_x (urx+1);
+  list_t *fl = list_new ();
+  int single = 0;
+
+  for (int i=optind+1; i < argc; i++) {
+    struct stat st;
+    if (stat (argv[i], &st) == 0 && S_ISDIR (st.st_mode)) {
+      add_dir (fl, argv[i]);
+    }
+    else {
+      list_append (fl, Strdup (argv[i]));
+    }
+  }
+
+  int nfiles = list_length (fl);
+  char **files;
+  long *llx, *lly, *urx, *ury;
+  listitem_t *li;
+  int k;
+
+  if (argc - optind == 2 && nfiles == 1) {
+    single = 1;
+  }
+
+  MALLOC (files, char *, nfiles + 1);
+  k = 0;
+  for (li = list_first (fl); li; li = list_next (li)) {
+    files[k++] = (char *) list_value (li);
+  }
+  list_free (fl);
+
+  MALLOC (llx, long, nfiles + 1);
+  MALLOC (lly, long, nfiles + 1);
+  MALLOC (urx, long, nfiles + 1);
+  MALLOC (ury, long, nfiles + 1);
 
-  lly = lp->snap_dn_y (lly);
-  ury = lp->snap_up_y (ury+1);
+  /* set up the technology tables once here; the lazy set-up in
+     Layout is not thread-safe, and the copy of geom.o linked into
+     this binary is not the one the layout pass initialized */
+  Layout::Init ();
 
-  printf ("bbox %ld %ld %ld %ld\n", llx, lly, urx, ury);
+  if (nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency ();
+  }
+  if (nthreads > nfiles) {
+    nthreads = nfiles;
+  }
+  if (nthreads <= 1) {
+    for (int i=0; i < nfiles; i++) {
+      rect_bbox (files[i], &llx[i], &lly[i], &urx[i], &ury[i]);
+    }
+  }
+  else {
+    std::vector<std::thread> workers;
+    std::atomic<int> idx (0);
+    for (int j=0; j < nthreads; j++) {
+      workers.push_back (std::thread ([&] () {
+	    int i;
+	    while ((i = idx++) < nfiles) {
+	      rect_bbox (files[i], &llx[i], &lly[i], &urx[i], &ury[i]);
+	    }
+	  }));
+    }
+    for (int j=0; j < nthreads; j++) {
+      workers[j].join ();
+    }
+  }
+
+  /* same snapping as computeLEFBoundary */
+  if (!raw) {
+    lp->snapBBox (nfiles, llx, lly, urx, ury);
+  }
+
+  if (single) {
+    printf ("bbox %ld %ld %ld %ld\n", llx[0], lly[0], urx[0], ury[0]);
+  }
+  else {
+    for (int i=0; i < nfiles; i++) {
+      printf ("%s %ld %ld %ld %ld\n", files[i], llx[i], lly[i], urx[i], ury[i]);
+    }
+  }
   return 0;
 }
@@ -25,8 +25,12 @@
 #include <act/passes.h>
 #include <math.h>
 #include <string.h>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include "stk_pass.h"
 #include "stk_layout.h"
+#include "fnv.h"
 
 #define IS_METAL_HORIZ(i) ((((i) % 2) == _horiz_metal) ? 1 : 0)
 
@@ -35,61 +39,52 @@
 #endif
 
 static double manufacturing_grid_in_nm;
+static int min_length;
 
-static long snap_up (long w, unsigned long pitch)
+long ActStackLayout::snap_up_x (long w)
 {
-  if (w >= 0) {
-    if (w % pitch != 0) {
-      w += pitch - (w % pitch);
-    }
-  }
-  else {
-    w = -w;
-    if (w % pitch != 0) {
-      w += pitch - (w % pitch);
-      w = w - pitch;
-    }
-    w = -w;
-  }
-  return w;
+  return _snap_x.up (w);
 }
 
-static long snap_dn (long w, unsigned long pitch)
+long ActStackLayout::snap_dn_x (long w)
 {
-  if (w >= 0) {
-    if (w % pitch != 0) {
-      w -= (w % pitch);
-    }
-  }
-  else {
-    w = -w;
-    if (w % pitch != 0) {
-      w -= (w % pitch);
-      w = w + pitch;
-    }
-    w = -w;
-  }
-  return w;
+  return _snap_x.dn (w);
 }
 
-long ActStackLayout::snap_up_x (long w)
+long ActStackLayout::snap_up_y (long w)
 {
-  return snap_up (w, _m_align_x->getPitch());
+  return _snap_y.up (w);
 }
 
-long ActStackLayout::snap_dn_x (long w)
+long ActStackLayout::snap_dn_y (long w)
 {
-  return snap_dn (w, _m_align_x->getPitch());
+  return _snap_y.dn (w);
 }
 
-long ActStackLayout::snap_up_y (long w)
+/*
+ * Snap a bloated bounding box out to the alignment grid. The upper
+ * coordinates are exclusive on return.
+ */
+void ActStackLayout::snapBBox (long *llx, long *lly, long *urx, long *ury)
 {
-  return snap_up (w, _m_align_y->getPitch());
+  *llx = _snap_x.dn (*llx);
+  *urx = _snap_x.up (*urx + 1);
+  *lly = _snap_y.dn (*lly);
+  *ury = _snap_y.up (*ury + 1);
 }
 
-long ActStackLayout::snap_dn_y (long w)
+/* ... the same for n boxes at a time */
+void ActStackLayout::snapBBox (int n, long *llx, long *lly,
+			       long *urx, long *ury)
 {
-  return snap_dn (w, _m_align_y->getPitch());
+  for (int i=0; i < n; i++) {
+    urx[i]++;
+    ury[i]++;
+  }
+  _snap_x.dn (llx, n);
+  _snap_x.up (urx, n);
+  _snap_y.dn (lly, n);
+  _snap_y.up (ury, n);
 }
 
 void layout_init (ActPass *a)
@@ -123,6 +118,12 @@ void layout_init (ActPass *a)
   dp->setParam ("raw", (void *)new ActStackLayout(a));
 }
 
+static int layout_cache_skip (void *cookie, Process *p)
+{
+  ActStackLayout *lp = (ActStackLayout *)cookie;
+  return lp->cacheValid (p);
+}
+
 ActStackLayout::ActStackLayout (ActPass *ap) 
 {
   me = ap;
@@ -178,6 +179,9 @@ ActStackLayout::ActStackLayout (ActPass *ap)
     _manufacturing_grid = 0.0005;
   }
   manufacturing_grid_in_nm = _manufacturing_grid*1e3;
+  min_length = config_get_int ("net.min_length") *
+    ActNetlistPass::getGridsPerLambda();
+  geomH = NULL;
 
   int x_align;
   int v;
@@ -192,6 +196,7 @@ ActStackLayout::ActStackLayout (ActPass *ap)
 		 v, Technology::T->nmetals);
   }
   _m_align_x = Technology::T->metal[v-1];
+  _snap_x.setPitch (_m_align_x->getPitch());
   x_align = v-1;
 
   if (config_exists ("lefdef.metal_align.y_dim")) {
@@ -205,6 +210,7 @@ ActStackLayout::ActStackLayout (ActPass *ap)
 		 v, Technology::T->nmetals);
   }
   _m_align_y = Technology::T->metal[v-1];
+  _snap_y.setPitch (_m_align_y->getPitch());
 
   if (config_exists ("lefdef.horiz_metal")) {
     _horiz_metal = config_get_int ("lefdef.horiz_metal");
@@ -299,6 +305,41 @@ ActStackLayout::ActStackLayout (ActPass *ap)
     _rect_wells = 0;
   }
 
+  if (config_exists ("lefdef.flatten_stacks")) {
+    _flatten_stacks = config_get_int ("lefdef.flatten_stacks");
+    if (_flatten_stacks != 0 && _flatten_stacks != 1) {
+      fatal_error ("lefdef.flatten_stacks: must be 0 or 1");
+    }
+  }
+  else {
+    _flatten_stacks = 0;
+  }
+
+  cacheH = NULL;
+  if (config_exists ("lefdef.cache_dir")) {
+    RawActStackPass *rsp;
+    _cache_dir = config_get_string ("lefdef.cache_dir");
+
+    /* processes with a valid cached layout don't need stacks */
+    rsp = (RawActStackPass *) stk->getPtrParam ("raw");
+    Assert (rsp, "What?");
+    rsp->setSkipFn (this, layout_cache_skip);
+  }
+  else {
+    _cache_dir = NULL;
+  }
+
+  if (config_exists ("lefdef.threads")) {
+    _threads = config_get_int ("lefdef.threads");
+    if (_threads < 1) {
+      fatal_error ("lefdef.threads: must be at least 1");
+    }
+  }
+  else {
+    _threads = 1;
+  }
+  parH = NULL;
+
   if (config_exists ("lefdef.extra_tracks.top")) {
     _extra_tracks_top = config_get_int ("lefdef.extra_tracks.top");
   }
@@ -354,11 +395,6 @@ static int getwidth (int idx, edge_t *e)
 /* actual edge length */
 static int getlength (edge_t *e, double adj)
 {
-  static int min_length = -1;
-  if (min_length == -1) {
-    min_length = config_get_int ("net.min_length") *
-      ActNetlistPass::getGridsPerLambda();
-  }
   if (e->l != min_length) {
     adj = 0;
   }
@@ -412,38 +448,21 @@ static void update_bbox (BBox *cur, int type, int x, int y, int rx, int ry)
 */
 static int locate_fetedge (Layout *L, int dx,
 			   unsigned int flags,
-			   edge_t *prev, int previdx,
-			   node_t *left, edge_t *e, int eidx)
+			   struct stk_egeom *gprev,
+			   node_t *left, edge_t *e, struct stk_egeom *ge)
 {
   DiffMat *d;
-  FetMat *f;
-  PolyMat *p;
   int rect;
   int fet_type; /* -1 = downward notch, +1 = upward notch, 0 = same
 		   width */
-  int spc = 0;
+  int spc = ge->spc;
 
-  int e_w = getwidth (0, e);
-  double la = L->leak_adjust();
+  /* the fet is located using the width of fold 0 */
+  int e_w = ge->w0;
 
   /* XXX: THIS CODE IS COPIED FROM emit_rectangle!!!!! */
 
   d = L->getDiff (e->type, e->flavor);
-  f = L->getFet (e->type, e->flavor);
-  p = L->getPoly ();
-
-  if (prev) {
-    spc = MAX (f->getSpacing (getlength (prev, la)),
-	       p->getSpacing (getlength (prev, la)));
-  }
-  else {
-    spc = 0;
-  }
-  if (e) {
-    spc = MAX (MAX (spc, f->getSpacing (getlength (e, la))),
-	       p->getSpacing (getlength (e, la)));
-  }
-  
 
   rect = 0;
   if (flags & EDGE_FLAGS_LEFT) {
@@ -452,8 +471,8 @@ static int locate_fetedge (Layout *L, int dx,
     rect = d->effOverhang (e_w, left->contact);
   }
   else {
-    Assert (prev, "Hmm");
-    int prev_w = getwidth (previdx, prev);
+    Assert (gprev, "Hmm");
+    int prev_w = gprev->w;
 
     if (prev_w == e_w) {
       fet_type = 0;
@@ -515,22 +534,20 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
 			   
 			   unsigned int flags, /* left/right edge? */
 			   
-			   edge_t *prev,
-			   int previdx,    /* previous edge: used to
-					      check for notches */
+			   struct stk_egeom *gprev, /* previous edge: used to
+						       check for notches */
 			   
 			   node_t *left,   /* left node */
 
 			   edge_t *e, /* edge to draw */
-			   edge_t *eopp, /* edge opposing it; used
-					    to check poly overhang */
+			   struct stk_egeom *ge, /* ... and its geometry */
+			   struct stk_egeom *gopp, /* edge opposing it; used
+						      to check poly overhang */
 
 			   int oup, /* amount of space available in
 				       y-direction until you encroach
 				       on the "other half" of the layout */
 			   
-			   int eidx, /* finger # */
-			   
 			   int yup,   /* +1 for p-type, -1 for n-type
 					 */
 			   
@@ -538,16 +555,14 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
 			   )
 {
   DiffMat *d;
-  FetMat *f;
-  PolyMat *p;
   int rect;
   int fet_type; /* -1 = downward notch, +1 = upward notch, 0 = same
 		   width */
 
   BBox b;
 
-  int e_w = getwidth (eidx, e);
-  double la = L->leak_adjust();
+  int e_w = ge->w;
+  int e_l = ge->l;
   
   if (ret) {
     b = *ret;
@@ -565,23 +580,9 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
   /* XXX: THIS CODE GETS COPIED TO locate_fetedge!!!! */
   
   d = L->getDiff (e->type, e->flavor);
-  f = L->getFet (e->type, e->flavor);
-  p = L->getPoly ();
   b.flavor = e->flavor;
 
-  int spc;
-  if (prev) {
-    spc = MAX (f->getSpacing (getlength (prev, la)),
-	       p->getSpacing (getlength (prev, la)));
-  }
-  else {
-    spc = 0;
-  }
-  if (e) {
-    spc = MAX (MAX (spc, f->getSpacing (getlength (e, la))),
-	       p->getSpacing (getlength (e, la)));
-  }
-  
+  int spc = ge->spc;
 
   int prev_w = 0;
 
@@ -592,8 +593,8 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
     rect = d->effOverhang (e_w, left->contact);
   }
   else {
-    Assert (prev, "Hmm");
-    prev_w = getwidth (previdx, prev);
+    Assert (gprev, "Hmm");
+    prev_w = gprev->w;
     
     if (prev_w == e_w) {
       fet_type = 0;
@@ -676,18 +677,17 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
 
   /* now print fet */
   if (yup < 0) {
-    L->DrawFet (e->flavor, e->type, dx, dy + yup*e_w, getlength (e, la),
-		-yup*e_w, NULL);
+    L->DrawFet (e->flavor, e->type, dx, dy + yup*e_w, e_l, -yup*e_w, NULL);
   }
   else {
-    L->DrawFet (e->flavor, e->type, dx, dy, getlength (e, la), yup*e_w, NULL);
+    L->DrawFet (e->flavor, e->type, dx, dy, e_l, yup*e_w, NULL);
   }
 
-  int poverhang = p->getOverhang (getlength (e, la));
+  int poverhang = ge->ovh;
   int uoverhang = poverhang;
 
   if (fet_type != 0) {
-    uoverhang = MAX (uoverhang, p->getNotchOverhang (getlength (e, la)));
+    uoverhang = MAX (uoverhang, ge->notch_ovh);
   }
   
 #if 0
@@ -695,13 +695,13 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
 #endif  
   /* now print poly edges */
   if (yup < 0) {
-    L->DrawPoly (dx, dy, getlength (e, la), -yup*poverhang, e->g);
-    L->DrawPoly (dx, dy + yup*(e_w+uoverhang), getlength(e, la), -yup*uoverhang, NULL);
+    L->DrawPoly (dx, dy, e_l, -yup*poverhang, e->g);
+    L->DrawPoly (dx, dy + yup*(e_w+uoverhang), e_l, -yup*uoverhang, NULL);
   }
   else {
     int oppoverhang;
-    if (eopp) {
-      oppoverhang = p->getOverhang (getlength (eopp, la));
+    if (gopp) {
+      oppoverhang = gopp->ovh;
     }
     else {
       oppoverhang = -1;
@@ -712,24 +712,24 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
        here. We really need to see both transistors! But here we
        assume that the overhang is the same for p and n.
     */
-    if (eopp &&  (oup + oppoverhang + poverhang >= dy)) {
+    if (gopp &&  (oup + oppoverhang + poverhang >= dy)) {
       int endpoly = oppoverhang + oup;
       int ht = dy - endpoly;
       //L->DrawPoly (dx, dy - yup*poverhang, getlength (e),
       //yup*poverhang, e->g);
       //printf ("adjust: %d, ht %d\n", endpoly, ht);
-      L->DrawPoly (dx, endpoly, getlength (e, la), ht, e->g);
+      L->DrawPoly (dx, endpoly, e_l, ht, e->g);
     }
     else {
-      L->DrawPoly (dx, dy - yup*poverhang, getlength (e, la), yup*poverhang, e->g);
+      L->DrawPoly (dx, dy - yup*poverhang, e_l, yup*poverhang, e->g);
     }
     
-    L->DrawPoly (dx, dy + yup*e_w, getlength (e, la), yup*uoverhang, NULL);
+    L->DrawPoly (dx, dy + yup*e_w, e_l, yup*uoverhang, NULL);
   }
   //printf ("done!\n");
   
 
-  dx += getlength (e, la);
+  dx += e_l;
   
   if (flags & EDGE_FLAGS_RIGHT) {
     node_t *right;
@@ -759,26 +759,22 @@ static int emit_rectangle (Layout *L,  /* where we are drawing */
   return dx;
 }
 
-static BBox print_dualstack (Layout *L, struct gate_pairs *gp, int diffspace)
+static BBox print_dualstack (Layout *L, struct stk_dual *gp,
+			     struct stk_egeom *gn, struct stk_egeom *gpp,
+			     int diffspace)
 {
   int flavor;
   int xpos, xpos_p;
   BBox b;
   int dx = 0;
-  
-  if (gp->basepair) {
-    flavor = gp->u.e.n->flavor;
+
+  Assert (gp->len > 0, "Empty stack?");
+  if (gp->n[0].e) {
+    flavor = gp->n[0].e->flavor;
   }
   else {
-    struct gate_pairs *tmp;
-    tmp = (struct gate_pairs *) list_value (list_first (gp->u.gp));
-    if (tmp->u.e.n) {
-      flavor = tmp->u.e.n->flavor;
-    }
-    else {
-      Assert (tmp->u.e.p, "Hmm");
-      flavor = tmp->u.e.p->flavor;
-    }
+    Assert (gp->p[0].e, "Hmm");
+    flavor = gp->p[0].e->flavor;
   }
 
   DiffMat *ndiff = Technology::T->diff[EDGE_NFET][flavor];
@@ -809,188 +805,63 @@ static BBox print_dualstack (Layout *L, struct gate_pairs *gp, int diffspace)
 
   int yp = +diffspace/2;
   int yn = yp - diffspace;
-  
-  if (gp->basepair) {
-    for (int i=0; i < gp->share; i++) {
-      int flags = 0;
-
-      if (i == 0) {
-	flags |= EDGE_FLAGS_LEFT;
-      }
-      if (i == gp->share-1) {
-	flags |= EDGE_FLAGS_RIGHT;
-      }
 
-      edge_t *n_prev, *p_prev;
-      int n_previdx, p_previdx;
-      node_t *n_left, *p_left;
-      int n_idx, p_idx;
+  struct stk_egeom *prevp = NULL, *prevn = NULL;
+  node_t *leftp = gp->pleft, *leftn = gp->nleft;
 
-      if (i == 0) {
-	n_prev = NULL;
-	n_previdx = 0;
-
-	p_prev = NULL;
-	p_previdx = 0;
-      }
-      else {
-	n_prev = gp->u.e.n;
-	n_previdx = gp->n_start + i - 1;
+  for (int i=0; i < gp->len; i++) {
+    struct stk_entry *en = &gp->n[i];
+    struct stk_entry *ep = &gp->p[i];
+    unsigned int flagsp = 0, flagsn = 0;
 
-	p_prev = gp->u.e.p;
-	p_previdx = gp->p_start + i - 1;
-      }
+    if (i < gp->plend) {
+      flagsp |= EDGE_FLAGS_LEFT;
+    }
+    if (i < gp->nlend) {
+      flagsn |= EDGE_FLAGS_LEFT;
+    }
+    if (i == gp->len-1 || !gp->p[i+1].e) {
+      flagsp |= EDGE_FLAGS_RIGHT;
+    }
+    if (i == gp->len-1 || !gp->n[i+1].e) {
+      flagsn |= EDGE_FLAGS_RIGHT;
+    }
 
-      if (i % 2 == 0) {
-	n_left = gp->l.n;
-	p_left = gp->l.p;
-      }
-      else {
-	n_left = gp->r.n;
-	p_left = gp->r.p;
-      }
-      
-      fposn = locate_fetedge (L, xpos, flags, n_prev, n_previdx, n_left,
-			      gp->u.e.n, gp->n_start + i);
-      
-      fposp = locate_fetedge (L, xpos, flags, p_prev, p_previdx, p_left,
-			      gp->u.e.p, gp->p_start + i);
-      
+    /* compute padding */
+    padn = 0;
+    padp = 0;
+    if (en->e && ep->e) {
+      fposn = locate_fetedge (L, xpos, flagsn, prevn, leftn, en->e, &gn[i]);
+      /* a base pair locates both fets from the n side */
+      fposp = locate_fetedge (L, gp->basepair ? xpos : xpos_p, flagsp,
+			      prevp, leftp, ep->e, &gpp[i]);
       if (fposn > fposp) {
 	padp = fposn - fposp;
-	padn = 0;
       }
       else {
 	padn = fposp - fposn;
-	padp = 0;
       }
-
-      xpos = emit_rectangle (L, padn, xpos, yn, flags,
-			     n_prev, n_previdx, n_left,
-			     gp->u.e.n, gp->u.e.p, yp,
-			     gp->n_start + i, -1, &b);
-    
-      xpos_p = emit_rectangle (L, padp, xpos_p, yp, flags,
-			       p_prev, p_previdx, p_left,
-			       gp->u.e.p, gp->u.e.n, yn,
-			       gp->p_start + i, 1, &b);
     }
-  }
-  else {
-    listitem_t *li;
-    int firstp = 1, firstn = 1;
-    edge_t *prevp = NULL, *prevn = NULL;
-    int prevpidx = 0, prevnidx = 0;
-    node_t *leftp, *leftn;
-
-    leftp = NULL;
-    leftn = NULL;
-
-    for (li = list_first (gp->u.gp); li; li = list_next (li)) {
-      struct gate_pairs *tmp;
-      unsigned int flagsp = 0, flagsn = 0;
-      tmp = (struct gate_pairs *) list_value (li);
-
-      Assert (tmp->basepair, "Hmm");
-
-      for (int i=0; i < tmp->share; i++) {
-      
-	if (firstp && tmp->u.e.p) {
-	  flagsp |= EDGE_FLAGS_LEFT;
-	  firstp = 0;
-	}
-	if (firstn && tmp->u.e.n) {
-	  firstn = 0;
-	  flagsn |= EDGE_FLAGS_LEFT;
-	}
-	if (!list_next (li) && i == (tmp->share-1)) {
-	  flagsp |= EDGE_FLAGS_RIGHT;
-	  flagsn |= EDGE_FLAGS_RIGHT;
-	}
-	else if (i == (tmp->share-1)) {
-	  struct gate_pairs *tnext;
-	  tnext = (struct gate_pairs *) list_value (list_next (li));
-	  if (!tnext->u.e.p) {
-	    flagsp |= EDGE_FLAGS_RIGHT;
-	  }
-	  if (!tnext->u.e.n) {
-	    flagsn |= EDGE_FLAGS_RIGHT;
-	  }
-	}
 
-	if (tmp->u.e.n) {
-	  if (!leftn) {
-	    leftn = gp->l.n;
-	  }
-	  else {
-	    Assert (prevn, "Hmm");
-	    if (prevn->a == leftn) {
-	      leftn = prevn->b;
-	    }
-	    else {
-	      Assert (prevn->b == leftn, "Hmm");
-	      leftn = prevn->a;
-	    }
-	  }
-	}
-	if (tmp->u.e.p) {
-	  if (!leftp) {
-	    leftp  = gp->l.p;
-	  }
-	  else {
-	    Assert (prevp, "Hmm");
-	    if (prevp->a == leftp) {
-	      leftp = prevp->b;
-	    }
-	    else {
-	      Assert (prevp->b == leftp, "Hmm");
-	      leftp = prevp->a;
-	    }
-	  }
-	}
+    if (en->e) {
+      xpos = emit_rectangle (L, padn, xpos, yn, flagsn,
+			     prevn, leftn, en->e, &gn[i],
+			     ep->e ? &gpp[i] : NULL, yp, -1, &b);
+      prevn = &gn[i];
+      leftn = en->n;
+      if (!ep->e) {
+	xpos_p = xpos;
+      }
+    }
 
-	/* compute padding */
-	padn = 0;
-	padp = 0;
-	if (tmp->u.e.n && tmp->u.e.p) {
-	  fposn = locate_fetedge (L, xpos, flagsn,
-				  prevn, prevnidx, leftn, tmp->u.e.n,
-				  tmp->n_start + i);
-	  fposp = locate_fetedge (L, xpos_p, flagsp,
-				  prevp, prevpidx, leftp, tmp->u.e.p,
-				  tmp->p_start + i);
-	  if (fposn > fposp) {
-	    padp = padp + fposn - fposp;
-	  }
-	  else {
-	    padn = padn + fposp - fposn;
-	  }
-	}
-      
-	if (tmp->u.e.n) {
-	  xpos = emit_rectangle (L, padn, xpos, yn, flagsn,
-				 prevn, prevnidx, leftn, tmp->u.e.n,
-				 tmp->u.e.p, yp,
-				 tmp->n_start + i, -1, &b);
-	  prevn = tmp->u.e.n;
-	  prevnidx = tmp->n_start + i;
-	  if (!tmp->u.e.p) {
-	    xpos_p = xpos;
-	  }
-	}
-      
-	if (tmp->u.e.p) {
-	  xpos_p = emit_rectangle (L, padp, xpos_p, yp, flagsp,
-				   prevp, prevpidx, leftp, tmp->u.e.p,
-				   tmp->u.e.n, yn,
-				   tmp->p_start + i, 1, &b);
-
-	  prevp = tmp->u.e.p;
-	  prevpidx = tmp->p_start + i;
-	  if (!tmp->u.e.n) {
-	    xpos = xpos_p;
-	  }
-	}
+    if (ep->e) {
+      xpos_p = emit_rectangle (L, padp, xpos_p, yp, flagsp,
+			       prevp, leftp, ep->e, &gpp[i],
+			       en->e ? &gn[i] : NULL, yn, 1, &b);
+      prevp = &gpp[i];
+      leftp = ep->n;
+      if (!en->e) {
+	xpos = xpos_p;
       }
     }
   }
@@ -998,19 +869,18 @@ static BBox print_dualstack (Layout *L, struct gate_pairs *gp, int diffspace)
 }
 
 
-static BBox print_singlestack (Layout *L, list_t *l,
-			       int diffspace, int xoff)
+static BBox print_singlestack (Layout *L, struct stk_single *l,
+			       struct stk_egeom *g, int diffspace, int xoff)
 {
   int flavor;
   int type;
   node_t *n;
-  edge_t *e;
-  edge_t *prev;
+  struct stk_egeom *prev;
   int xpos;
   int ypos = 0;
   BBox b;
-  int idx = 0;
-  int previdx = 0;
+
+  xpos = xoff;
 
   b.p.llx = xpos;
   b.p.lly = 0;
@@ -1018,14 +888,10 @@ static BBox print_singlestack (Layout *L, list_t *l,
   b.p.ury = 0;
   b.n = b.p;
 
-  if (list_length (l) < 4) return b;
+  if (l->len < 1) return b;
 
-  n = (node_t *) list_value (list_first (l));
-  e = (edge_t *) list_value (list_next (list_first (l)));
-  idx = (long) list_value (list_next (list_next (list_first (l))));
-  
-  flavor = e->flavor;
-  type = e->type;
+  flavor = l->s[0].e->flavor;
+  type = l->s[0].e->type;
   
   DiffMat *diff = Technology::T->diff[type][flavor];
   FetMat *fet = Technology::T->fet[type][flavor];
@@ -1035,43 +901,30 @@ static BBox print_singlestack (Layout *L, list_t *l,
   if (type == EDGE_NFET) {
     ypos = ypos - diffspace;
   }
-  xpos = xoff;
 
   /* ok, now we can draw! */
   Assert (fet && diff && poly, "What?");
 
   /* lets draw rectangles */
-  listitem_t *li;
-
   prev = NULL;
-  previdx = 0;
-  li = list_first (l);
-  while (li && list_next (li) && list_next (list_next (li))) {
+  n = l->left;
+  for (int i=0; i < l->len; i++) {
     unsigned int flags = 0;
-    node_t *m;
-
-    n = (node_t *) list_value (li);
-    e = (edge_t *) list_value (list_next (li));
-    idx = (long) list_value (list_next (list_next (li)));
-    m = (node_t *) list_value (list_next (list_next (list_next (li))));
+    struct stk_entry *x = &l->s[i];
 
-    if (li == list_first (l)) {
+    if (i == 0) {
       flags |= EDGE_FLAGS_LEFT;
     }
-    if (!list_next (list_next (list_next (list_next (li))))) {
+    if (i == l->len-1) {
       flags |= EDGE_FLAGS_RIGHT;
     }
 
-    xpos = emit_rectangle (L, 0, xpos, ypos, flags, prev, previdx, 
-			   n, e, NULL, 0, idx,
+    xpos = emit_rectangle (L, 0, xpos, ypos, flags, prev,
+			   n, x->e, &g[i], NULL, 0,
 			   (type == EDGE_NFET ? -1 : 1), &b);
-    prev = e;
-    previdx = idx;
-
-    li = list_next (list_next (list_next (li)));
+    prev = &g[i];
+    n = x->n;
   }
-  Assert (li && !list_next (li), "Eh?");
-  n = (node_t *) list_value (li);
   
   return b;
 }
@@ -1087,7 +940,29 @@ void *ActStackLayout::localop (ActPass *ap, Process *p, int mode)
     _fpcell = (FILE *)dp->getPtrParam ("cell_file");
   }
   if (mode == 0) {
-    return _createlocallayout (p);
+    netlist_t *supply;
+    LayoutBlob *blob;
+    if (_threads > 1) {
+      phash_bucket_t *b;
+      if (!parH) {
+	_createparallel ();
+      }
+      b = phash_lookup (parH, p);
+      if (b) {
+	blob = (LayoutBlob *) b->v;
+	if (blob) {
+	  blob->finalize ();
+	}
+	return blob;
+      }
+    }
+    blob = _createlocallayout (p, &supply);
+    _setdummy (supply);
+    /* the layout is complete; later searches can be memoized */
+    if (blob) {
+      blob->finalize ();
+    }
+    return blob;
   }
   else if (mode == 1) {
     emitLEFHeader (_fp);
@@ -1163,14 +1038,35 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
   printf (" === processing %s\n", cname);
 #endif  
   /* found a .rect file! Override layout generation */
-  Layout *tmp = new Layout (nl->getNL (p));
+  int diffspace = -1;
+  struct layout_cache_info *ci = _cacheinfo (p);
+  LayoutBlob *b;
+
+  if (ci && ci->valid) {
+    /* no stacks available */
+    diffspace = ci->diffspace;
+  }
   if (tmpname) {
-    tmp->ReadRect (tmpname);
+    b = _readRect (p, tmpname, diffspace);
     FREE (tmpname);
   }
   else {
-    tmp->ReadRect (cname);
+    b = _readRect (p, cname, diffspace);
   }
+  b->markRead ();
+  
+  return b;
+}
+
+/*
+ * Read in layout from a .rect file, aligning the diffusion to y=0.
+ * If diffspace is negative, it is computed from the stacks.
+ */
+LayoutBlob *ActStackLayout::_readRect (Process *p, const char *cname,
+				       int diffspace)
+{
+  Layout *tmp = new Layout (nl->getNL (p));
+  tmp->ReadRect (cname);
   tmp->propagateAllNets ();
   tmp->markPins ();
 #if 0 
@@ -1182,7 +1078,6 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
   /* now shift all the tiles to line up 0,0 in the middle of the
      diffusion section */
   DiffMat *d = NULL;
-  list_t *tiles = NULL;
   int type, flavor;
   long ymin, ymax;
   long updiff, dndiff;
@@ -1190,19 +1085,18 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
   
   for (int i=0; i < Technology::T->num_devs; i++) {
     for (int j=0; j < 2; j++) {
-      tiles = b->search (TILE_FLGS_TO_ATTR(i,j,DIFF_OFFSET));
-      if (list_isempty (tiles)) {
-	list_free (tiles);
-      }
-      else {
+      long xmin, xmax, tymin, tymax;
+      b->searchBBox (BLOB_SEARCH_TYPE, NULL,
+		     TILE_FLGS_TO_ATTR(i,j,DIFF_OFFSET), NULL,
+		     &xmin, &tymin, &xmax, &tymax);
+      if (xmin <= xmax) {
 	/* done! */
-	long xmin, xmax;
+	/* calculate ymin, ymax */
+	ymin = tymin;
+	ymax = tymax;
 	d = Technology::T->diff[j][i];
 	type = j;
 	flavor = i;
-	LayoutBlob::searchBBox (tiles, &xmin, &ymin, &xmax, &ymax);
-	/* calculate ymin, ymax */
-	LayoutBlob::searchFree (tiles);
 	set_diff++;
 	if (type == EDGE_PFET) {
 	  updiff = ymin;
@@ -1227,7 +1121,9 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
     */
 
     //int diffspace = d->getOppDiffSpacing (flavor);
-    int diffspace = _localdiffspace (p);
+    if (diffspace < 0) {
+      diffspace = _localdiffspace (p);
+    }
 
     if (set_diff == 2) {
       if ((updiff - dndiff) != diffspace) {
@@ -1254,7 +1150,6 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
   }
   
   b = computeLEFBoundary (b);
-  b->markRead ();
   
   return b;
 }
@@ -1266,14 +1161,17 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
  * for the local circuits within the process
  *
  */
-LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
+LayoutBlob *ActStackLayout::_createlocallayout (Process *p,
+						netlist_t **supply)
 {
-  list_t *stks;
+  struct stk_result *stks;
   BBox b;
   LayoutBlob *BLOB;
 
   Assert (stk, "What?");
 
+  *supply = NULL;
+
   act_languages *lang = p->getlang();
 
   if (p->isBlackBox() || p->isLowLevelBlackBox()) {
@@ -1287,9 +1185,19 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     }
     return BLOB;
   }
+
+  if (cacheValid (p)) {
+    /* stacks were skipped; a .rect import still takes precedence */
+    BLOB = _readlocalRect (p);
+    if (!BLOB) {
+      BLOB = _readcached (p);
+      *supply = nl->getNL (p);
+    }
+    return BLOB;
+  }
  
-  stks = (list_t *) stk->getMap (p);
-  if (!stks || list_length (stks) == 0) {
+  stks = (struct stk_result *) stk->getMap (p);
+  if (!stks) {
     return NULL;
   }
 
@@ -1304,31 +1212,24 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
   b.n.ury = 0;
   b.p = b.n;
 
-  listitem_t *li;
-
-  li = list_first (stks);
-  list_t *stklist = (list_t *) list_value (li);
-
   BLOB = new LayoutBlob (BLOB_LIST);
 
-  int diffspace = _localdiffspace (p);
+  struct layout_geom *geom = _geom (p);
+  int diffspace = geom->diffspace;
 
   int has_both_types = 0;
 
   //printf ("Creating local layout: %s\n", p->getName());
 
-  if (list_length (stklist) > 0) {
+  if (stks->ndual > 0) {
     /* dual stacks */
-    listitem_t *si;
-
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      struct gate_pairs *gp;
+    for (int si=0; si < stks->ndual; si++) {
+      struct stk_dual *gp = &stks->dual[si];
       Layout *l = new Layout(nl->getNL (p));
-      gp = (struct gate_pairs *) list_value (si);
       has_both_types = 1;
 
       /*--- process gp ---*/
-      b = print_dualstack (l, gp, diffspace);
+      b = print_dualstack (l, gp, geom->dn[si], geom->dp[si], diffspace);
       
       l->DrawDiffBBox (b.flavor, EDGE_PFET,
 		       b.p.llx, b.p.lly, b.p.urx-b.p.llx, b.p.ury-b.p.lly);
@@ -1339,27 +1240,21 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     }
   }
 
-  li = list_next (li);
-  stklist = (list_t *) list_value (li);
-
   /* XXX: check singlestack!!! */
   int nxpos = b.n.urx;
   int pxpos = b.p.urx;
 
-  if (stklist && (list_length (stklist) > 0)) {
+  if (stks->nn > 0) {
     /* n stacks */
-    listitem_t *si;
-
-    if (!has_both_types && list_value (list_next (li)) &&
-	(list_length ((list_t*) list_value (list_next (li))) > 0)) {
+    if (!has_both_types && stks->np > 0) {
       has_both_types = 1;
     }
 
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      list_t *sl = (list_t *) list_value (si);
+    for (int si=0; si < stks->nn; si++) {
+      struct stk_single *sl = &stks->n[si];
       Layout *l = new Layout (nl->getNL (p));
 
-      b = print_singlestack (l, sl, diffspace, nxpos);
+      b = print_singlestack (l, sl, geom->n[si], diffspace, nxpos);
       
       l->DrawDiffBBox (b.flavor, EDGE_NFET, b.n.llx, b.n.lly,
 		       b.n.urx - b.n.llx, b.n.ury - b.n.lly);
@@ -1378,17 +1273,13 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     }
   }
 
-  li = list_next (li);
-  stklist = (list_t *) list_value (li);
-  if (stklist && (list_length (stklist) > 0)) {
+  if (stks->np > 0) {
     /* p stacks */
-    listitem_t *si;
-
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      list_t *sl = (list_t *) list_value (si);
+    for (int si=0; si < stks->np; si++) {
+      struct stk_single *sl = &stks->p[si];
       Layout *l = new Layout (nl->getNL (p));
 
-      b = print_singlestack (l, sl, diffspace, pxpos);
+      b = print_singlestack (l, sl, geom->p[si], diffspace, pxpos);
       
       l->DrawDiffBBox (b.flavor, EDGE_PFET, b.p.llx, b.p.lly,
 		       b.p.urx - b.p.llx, b.p.ury - b.p.lly);
@@ -1407,6 +1298,11 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     }
   }
 
+  if (_flatten_stacks) {
+    /* the list has placed the stacks; paint them into one layout */
+    BLOB = LayoutBlob::flatten (BLOB);
+  }
+
   /* now we need to adjust the boundary of this cell to make sure
      several alignment restrictions are satisfied.
      
@@ -1425,9 +1321,7 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
   /* --- add pins --- */
   netlist_t *n = nl->getNL (p);
 
-  if (!dummy_netlist && n->psc && n->nsc) {
-    dummy_netlist = n;
-  }
+  *supply = n;
 
   Rectangle b_bbox;
   b_bbox = BLOB->getBBox ();
@@ -1695,7 +1589,6 @@ LayoutBlob *ActStackLayout::_readwelltap (int flavor)
   /* now shift all the tiles to line up 0,0 in the middle of the
      ppdiff/nndiff diffusion section */
   DiffMat *d = NULL;
-  list_t *tiles = NULL;
   int type;
   long ymin, ymax;
   long updiff, dndiff;
@@ -1706,19 +1599,18 @@ LayoutBlob *ActStackLayout::_readwelltap (int flavor)
 
   
   for (int j=0; j < 2; j++) {
-    tiles = b->search (TILE_FLGS_TO_ATTR(flavor,j,WDIFF_OFFSET));
-    if (list_isempty (tiles)) {
-      list_free (tiles);
-    }
-    else {
+    long xmin, xmax, tymin, tymax;
+    b->searchBBox (BLOB_SEARCH_TYPE, NULL,
+		   TILE_FLGS_TO_ATTR(flavor,j,WDIFF_OFFSET), NULL,
+		   &xmin, &tymin, &xmax, &tymax);
+    if (xmin <= xmax) {
       /* done! */
-      long xmin, xmax;
       d = Technology::T->welldiff[j][flavor];
       if (d) {
 	type = j;
-	LayoutBlob::searchBBox (tiles, &xmin, &ymin, &xmax, &ymax);
 	/* calculate ymin, ymax */
-	LayoutBlob::searchFree (tiles);
+	ymin = tymin;
+	ymax = tymax;
 	set_diff++;
 	if (type == EDGE_PFET) {
 	  updiff = ymin;
@@ -1788,6 +1680,11 @@ LayoutBlob *ActStackLayout::_createwelltap (int flavor)
   if (!nplusdiff && !pplusdiff) {
     return NULL;
   }
+
+  BLOB = _readcachedwelltap (flavor);
+  if (BLOB) {
+    return BLOB;
+  }
     
   int diffspace;
   
@@ -1878,9 +1775,198 @@ LayoutBlob *ActStackLayout::_createwelltap (int flavor)
 
   BLOB = computeLEFBoundary (bl);
 
+  _writecachedwelltap (flavor, BLOB);
+
   return BLOB;
 }
 
+/*
+ * Welltaps are cached as <cache_dir>/welltap_<flavor>.rect, in their
+ * own coordinates, next to a .fp file holding a hash of everything
+ * _createwelltap() depends on.
+ */
+unsigned long ActStackLayout::_welltapfp (int flavor)
+{
+  unsigned long h = FNV_INIT;
+  char buf[1024];
+
+  h = fnv_hash_int (h, flavor);
+  h = fnv_hash_int (h, lambda_to_scale);
+  for (int j=0; j < 2; j++) {
+    DiffMat *d = Technology::T->welldiff[j][flavor];
+    WellMat *w = Technology::T->well[j][flavor];
+    if (d) {
+      h = fnv_hash_int (h, d->minWidth());
+      h = fnv_hash_int (h, d->minArea());
+      h = fnv_hash_int (h, d->getOppDiffSpacing (flavor));
+    }
+    else {
+      h = fnv_hash_int (h, -1);
+    }
+    h = fnv_hash_int (h, w ? w->getOverhangWelldiff() : -1);
+  }
+  h = fnv_hash_int (h, Technology::T->getMaxSameDiffSpacing());
+  h = fnv_hash_int (h, _pin_layer);
+  h = fnv_hash_int (h, _pin_metal->getLEFWidth());
+  h = fnv_hash_int (h, _pin_metal->minSpacing());
+  h = fnv_hash_int (h, _m_align_x->getPitch());
+  h = fnv_hash_int (h, _m_align_y->getPitch());
+  h = fnv_hash_int (h, _extra_tracks_top);
+  h = fnv_hash_int (h, _extra_tracks_bot);
+  h = fnv_hash_int (h, _extra_tracks_left);
+  h = fnv_hash_int (h, _extra_tracks_right);
+
+  /* the supply nets are named in the .rect file */
+  ActNetlistPass::sprint_node (buf, 1024, dummy_netlist, dummy_netlist->nsc);
+  h = fnv_hash (h, buf, strlen (buf));
+  ActNetlistPass::sprint_node (buf, 1024, dummy_netlist, dummy_netlist->psc);
+  h = fnv_hash (h, buf, strlen (buf));
+
+  return h;
+}
+
+/*
+ * The cached layout of a cell depends on more than its netlist: the
+ * technology rules used to draw its fets, and the layout options.
+ */
+unsigned long ActStackLayout::_cellfp (Process *p)
+{
+  RawActStackPass *rsp;
+  netlist_t *N;
+  unsigned long h;
+  PolyMat *poly = Technology::T->poly;
+  double la;
+
+  rsp = (RawActStackPass *) stk->getPtrParam ("raw");
+  Assert (rsp, "What?");
+  N = nl->getNL (p);
+  Assert (N, "What?");
+  la = N->leak_correct ? Layout::getLeakAdjust() : 0;
+
+  h = rsp->fingerprint (p);
+  h = fnv_hash_int (h, lambda_to_scale);
+  h = fnv_hash (h, &Technology::T->scale, sizeof (Technology::T->scale));
+  h = fnv_hash (h, &manufacturing_grid_in_nm,
+		   sizeof (manufacturing_grid_in_nm));
+  h = fnv_hash_int (h, min_length);
+  h = fnv_hash (h, &la, sizeof (la));
+  h = fnv_hash_int (h, _flatten_stacks);
+  h = fnv_hash_int (h, _rect_wells);
+  h = fnv_hash_int (h, _horiz_metal);
+  h = fnv_hash_int (h, _pin_layer);
+  h = fnv_hash_int (h, _pin_metal->getLEFWidth());
+  h = fnv_hash_int (h, _pin_metal->minSpacing());
+  h = fnv_hash_int (h, _m_align_x->getPitch());
+  h = fnv_hash_int (h, _m_align_y->getPitch());
+  h = fnv_hash_int (h, _extra_tracks_top);
+  h = fnv_hash_int (h, _extra_tracks_bot);
+  h = fnv_hash_int (h, _extra_tracks_left);
+  h = fnv_hash_int (h, _extra_tracks_right);
+  h = fnv_hash_int (h, Technology::T->getMaxSameDiffSpacing());
+
+  /* the rules each fet is drawn with */
+  for (node_t *n = N->hd; n; n = n->next) {
+    listitem_t *li;
+    for (li = list_first (n->e); li; li = list_next (li)) {
+      edge_t *e = (edge_t *) list_value (li);
+      if (e->a != n) continue;
+      DiffMat *d = Technology::T->diff[e->type][e->flavor];
+      FetMat *f = Technology::T->fet[e->type][e->flavor];
+      int l = getlength (e, la);
+      if (!d || !f) {
+	h = fnv_hash_int (h, -1);
+	continue;
+      }
+      h = fnv_hash_int (h, l);
+      h = fnv_hash_int (h, f->getSpacing (l));
+      h = fnv_hash_int (h, poly->getSpacing (l));
+      h = fnv_hash_int (h, poly->getOverhang (l));
+      h = fnv_hash_int (h, poly->getNotchOverhang (l));
+      h = fnv_hash_int (h, d->viaSpaceMid());
+      h = fnv_hash_int (h, d->getNotchSpacing());
+      h = fnv_hash_int (h, d->getOppDiffSpacing (e->flavor));
+      for (int i=0; i < e->nfolds; i++) {
+	int w = getwidth (i, e);
+	h = fnv_hash_int (h, w);
+	h = fnv_hash_int (h, d->effOverhang (w));
+	h = fnv_hash_int (h, d->effOverhang (w, 1));
+      }
+    }
+  }
+  return h;
+}
+
+LayoutBlob *ActStackLayout::_readcachedwelltap (int flavor)
+{
+  char buf[10240];
+  FILE *fp;
+  unsigned long x;
+  int ok;
+
+  if (!_cache_dir) {
+    return NULL;
+  }
+  snprintf (buf, 10240, "%s/welltap_%s.fp", _cache_dir,
+	    act_dev_value_to_string (flavor));
+  fp = fopen (buf, "r");
+  if (!fp) {
+    return NULL;
+  }
+  ok = (fscanf (fp, "%lx", &x) == 1 && x == _welltapfp (flavor));
+  fclose (fp);
+  if (!ok) {
+    return NULL;
+  }
+
+  snprintf (buf, 10240, "%s/welltap_%s.rect", _cache_dir,
+	    act_dev_value_to_string (flavor));
+  fp = fopen (buf, "r");
+  if (!fp) {
+    return NULL;
+  }
+  fclose (fp);
+
+  Layout *l = new Layout (dummy_netlist);
+  l->ReadRect (buf);
+  l->propagateAllNets ();
+
+  /* .rect files don't keep the pin attribute */
+  l->getLayerMetal (_pin_layer)->markPins (dummy_netlist->nsc, 1);
+  l->getLayerMetal (_pin_layer)->markPins (dummy_netlist->psc, 1);
+
+  return computeLEFBoundary (new LayoutBlob (BLOB_BASE, l));
+}
+
+void ActStackLayout::_writecachedwelltap (int flavor, LayoutBlob *b)
+{
+  char buf[10240];
+  FILE *fp;
+
+  if (!_cache_dir || !b) {
+    return;
+  }
+  snprintf (buf, 10240, "%s/welltap_%s.rect", _cache_dir,
+	    act_dev_value_to_string (flavor));
+  fp = fopen (buf, "w");
+  if (!fp) {
+    warning ("Could not open cache file `%s' for writing", buf);
+    return;
+  }
+  b->PrintRect (fp);
+  fclose (fp);
+
+  /* written last, so that an incomplete cache entry is never valid */
+  snprintf (buf, 10240, "%s/welltap_%s.fp", _cache_dir,
+	    act_dev_value_to_string (flavor));
+  fp = fopen (buf, "w");
+  if (!fp) {
+    warning ("Could not open cache file `%s' for writing", buf);
+    return;
+  }
+  fprintf (fp, "%lx\n", _welltapfp (flavor));
+  fclose (fp);
+}
+
 
 void ActStackLayout::_emitwelltaprect (int flavor)
 {
@@ -1954,17 +2040,93 @@ void layout_run (ActPass *_ap, Process *p)
   lp->run_post ();
 }
 
+/*
+ * The welltap cells use the substrate contacts of the first netlist
+ * (in traversal order) that has both of them.
+ */
+void ActStackLayout::_setdummy (netlist_t *n)
+{
+  if (!dummy_netlist && n && n->psc && n->nsc) {
+    dummy_netlist = n;
+  }
+}
+
+/*
+ * Mode 0 for all processes at once. The stk pass has already visited
+ * every process, so its traversal order is used to hand out work.
+ * The workers only read shared state: the cache and geometry tables
+ * are filled in up front, and the welltap netlist is picked
+ * afterwards in order.
+ */
+void ActStackLayout::_createparallel ()
+{
+  RawActStackPass *rsp;
+  listitem_t *li;
+  std::vector<Process *> procs;
+  std::vector<LayoutBlob *> blobs;
+  std::vector<netlist_t *> supply;
+  std::vector<std::thread> workers;
+  std::atomic<int> idx (0);
+  int nthreads;
+
+  rsp = (RawActStackPass *) stk->getPtrParam ("raw");
+  Assert (rsp, "What?");
+
+  for (li = list_first (rsp->getProcs()); li; li = list_next (li)) {
+    Process *p = (Process *) list_value (li);
+    procs.push_back (p);
+    cacheValid (p);
+    if (!p->isBlackBox() && !p->isLowLevelBlackBox()) {
+      _geom (p);
+    }
+  }
+  blobs.resize (procs.size(), NULL);
+  supply.resize (procs.size(), NULL);
+
+  nthreads = _threads;
+  if (nthreads > (int)procs.size()) {
+    nthreads = procs.size();
+  }
+  for (int i=0; i < nthreads; i++) {
+    workers.push_back (std::thread ([&] () {
+	  int j;
+	  while ((j = idx++) < (int)procs.size()) {
+	    blobs[j] = _createlocallayout (procs[j], &supply[j]);
+	  }
+	}));
+  }
+  for (int i=0; i < nthreads; i++) {
+    workers[i].join ();
+  }
+
+  parH = phash_new (4);
+  for (int j=0; j < (int)procs.size(); j++) {
+    phash_bucket_t *b = phash_add (parH, procs[j]);
+    b->v = blobs[j];
+    _setdummy (supply[j]);
+  }
+}
+
 void ActStackLayout::run_post (void)
 {
   if (!dummy_netlist) {
     fatal_error ("Layout generation: could not find both power supplies for substrate contacts!");
   }
 
+  if (wellplugs) {
+    /* already created by an earlier run */
+    return;
+  }
+
   /* create welltap cells */
   int ntaps = config_get_table_size ("act.dev_flavors");
   MALLOC (wellplugs, LayoutBlob *, ntaps);
   for (int flavor=0; flavor < ntaps; flavor++) {
     wellplugs[flavor] = _createwelltap (flavor);
+    if (wellplugs[flavor]) {
+      /* exported as .rect and LEF */
+      wellplugs[flavor]->freeze ();
+    }
   }
 }
 
@@ -1987,6 +2149,9 @@ void ActStackLayout::_emitlocalRect (Process *p)
   TransformMat mat;
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
 
+  /* flattened once; also used by the LEF output */
+  blob->freeze ();
+
   FILE *fp;
   char cname[10240];
 
@@ -2008,23 +2173,34 @@ void ActStackLayout::_emitlocalRect (Process *p)
     outdir = _rect_outinitdir;
   }
 
+  char *outname;
   if (outdir) {
-    char *outname;
     int sz = strlen (cname) + strlen (outdir) + 2;
     MALLOC (outname, char, sz);
     snprintf (outname, sz, "%s/%s", outdir, cname);
-    fp = fopen (outname, "w");
-    if (!fp) {
-      fatal_error ("Could not open file `%s' for writing", outname);
-    }
-    FREE (outname);
   }
   else {
-    fp = fopen (cname, "w");
-    if (!fp) {
-      fatal_error ("Could not open file `%s' for writing", cname);
+    outname = Strdup (cname);
+  }
+
+  if (cacheValid (p)) {
+    /* unchanged since the .rect file was written */
+    fp = fopen (outname, "r");
+    if (fp) {
+      fclose (fp);
+      FREE (outname);
+      return;
     }
   }
+  else if (_cache_dir && !blob->getRead()) {
+    _writecache (p, blob, &mat);
+  }
+  
+  fp = fopen (outname, "w");
+  if (!fp) {
+    fatal_error ("Could not open file `%s' for writing", outname);
+  }
+  FREE (outname);
   blob->PrintRect (fp, &mat);
 
   if (_rect_wells) {
@@ -2045,6 +2221,123 @@ void ActStackLayout::_emitlocalRect (Process *p)
   fclose (fp);
 }
 
+/*
+ * Layout cache: for each process, <cache_dir>/<proc>.rect holds the
+ * generated layout and <cache_dir>/<proc>.fp holds the fingerprint
+ * of the netlist, rules and options it was generated from, plus the
+ * diffusion spacing needed to read it back in without the stacks.
+ */
+void ActStackLayout::_cachename (Process *p, const char *ext,
+				 char *buf, int sz)
+{
+  int len;
+  snprintf (buf, sz, "%s/", _cache_dir);
+  len = strlen (buf);
+  a->msnprintfproc (buf + len, sz - len, p);
+  len = strlen (buf);
+  snprintf (buf + len, sz - len, "%s", ext);
+}
+
+struct layout_cache_info *ActStackLayout::_cacheinfo (Process *p)
+{
+  phash_bucket_t *b;
+  struct layout_cache_info *ci;
+  char buf[10240];
+  FILE *fp;
+
+  if (!_cache_dir || !p || p->isBlackBox() || p->isLowLevelBlackBox()) {
+    return NULL;
+  }
+  if (!cacheH) {
+    cacheH = phash_new (4);
+  }
+  b = phash_lookup (cacheH, p);
+  if (b) {
+    return (struct layout_cache_info *) b->v;
+  }
+
+  NEW (ci, struct layout_cache_info);
+  ci->fp = _cellfp (p);
+  ci->valid = 0;
+  ci->diffspace = 0;
+  b = phash_add (cacheH, p);
+  b->v = ci;
+
+  _cachename (p, ".fp", buf, 10240);
+  fp = fopen (buf, "r");
+  if (fp) {
+    unsigned long x;
+    int d;
+    if (fscanf (fp, "%lx %d", &x, &d) == 2 && x == ci->fp) {
+      FILE *tfp;
+      _cachename (p, ".rect", buf, 10240);
+      tfp = fopen (buf, "r");
+      if (tfp) {
+	fclose (tfp);
+	ci->valid = 1;
+	ci->diffspace = d;
+      }
+    }
+    fclose (fp);
+  }
+  return ci;
+}
+
+int ActStackLayout::cacheValid (Process *p)
+{
+  struct layout_cache_info *ci = _cacheinfo (p);
+  if (ci && ci->valid) {
+    return 1;
+  }
+  return 0;
+}
+
+LayoutBlob *ActStackLayout::_readcached (Process *p)
+{
+  struct layout_cache_info *ci = _cacheinfo (p);
+  char buf[10240];
+  FILE *fp;
+
+  Assert (ci && ci->valid, "What?");
+  _cachename (p, ".rect", buf, 10240);
+  fp = fopen (buf, "r");
+  if (!fp) {
+    fatal_error ("Cached layout `%s' disappeared!", buf);
+  }
+  fclose (fp);
+  return _readRect (p, buf, ci->diffspace);
+}
+
+void ActStackLayout::_writecache (Process *p, LayoutBlob *blob,
+				  TransformMat *mat)
+{
+  struct layout_cache_info *ci = _cacheinfo (p);
+  char buf[10240];
+  FILE *fp;
+
+  if (!ci) {
+    return;
+  }
+  _cachename (p, ".rect", buf, 10240);
+  fp = fopen (buf, "w");
+  if (!fp) {
+    warning ("Could not open cache file `%s' for writing", buf);
+    return;
+  }
+  blob->PrintRect (fp, mat);
+  fclose (fp);
+
+  /* written last, so that an incomplete cache entry is never valid */
+  _cachename (p, ".fp", buf, 10240);
+  fp = fopen (buf, "w");
+  if (!fp) {
+    warning ("Could not open cache file `%s' for writing", buf);
+    return;
+  }
+  fprintf (fp, "%lx %d\n", ci->fp, _localdiffspace (p));
+  fclose (fp);
+}
+
 static void emit_header (FILE *fp, const char *name, const char *lefclass,
 			 LayoutBlob *blob)
 {
@@ -2074,142 +2367,177 @@ static void emit_footer (FILE *fp, const char *name)
   fprintf (fp, "END %s\n\n", name);
 }
 
-static int emit_layer_rects (FILE *fp, list_t *tiles, node_t **io = NULL,
-			      int num_io = 0)
+/* state for emitting the metal rectangles of a blob */
+struct layer_rects {
+  FILE *fp;
+  double scale;
+  node_t **io;			// nets to skip
+  int num_io;
+  int emit_obs;			// 1 if OBS has been printed
+  Layer *lprev;			// last LAYER printed
+  int vprev;
+};
+
+/* b(i) is r transformed into LEF coordinates */
+static void emit_layer_rect (struct layer_rects *lr,
+			     const struct blob_rect *r, RectBatch *b, int i)
 {
-  double scale = Technology::T->scale/1000.0;
-  listitem_t *tli;
-  int emit_obs = 0;
+  Layer *lname = r->l;
+  Tile *tmp = r->t;
+  int via = r->via;
 
-  for (tli = list_first (tiles); tli; tli = list_next (tli)) {
-    struct tile_listentry *tle = (struct tile_listentry *) list_value (tli);
-    listitem_t *xi;
-    Layer *lprev = NULL;
+  if (!lname->isMetal()) {
+    return;
+  }
 
-    for (xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
-      Layer *lname = (Layer *) list_value (xi);
-      xi = list_next (xi);
-      Assert (xi, "Hmm");
+  if (tmp->getNet()) {
+    int k;
+    for (k=0; k < lr->num_io; k++) {
+      if (tmp->getNet() == lr->io[k])
+	break;
+    }
+    if (k != lr->num_io) {
+      /* skip! */
+      return;
+    }
+  }
 
-      if (!lname->isMetal()) {
-	continue;
-      }
+  if (!lr->emit_obs && lr->io != NULL) {
+    fprintf (lr->fp, "    OBS\n");
+    lr->emit_obs = 1;
+  }
+  if (lname != lr->lprev || via != lr->vprev) {
+    if (via) {
+      fprintf (lr->fp, "        LAYER %s ;\n", lname->getViaName());
+    }
+    else {
+      fprintf (lr->fp, "        LAYER %s ;\n", lname->getRouteName());
+    }
+    lr->lprev = lname;
+    lr->vprev = via;
+  }
 
-      list_t *actual_tiles = (list_t *) list_value (xi);
-      listitem_t *ti;
-      int first = 1;
-      
-      for (ti = list_first (actual_tiles); ti; ti = list_next (ti)) {
-	long tllx, tlly, turx, tury;
-	Tile *tmp = (Tile *) list_value (ti);
-
-	if (tmp->getNet()) {
-	  int k;
-	  for (k=0; k < num_io; k++) {
-	    if (tmp->getNet() == io[k])
-	      break;
-	  }
-	  if (k != num_io) {
-	    /* skip! */
-	    continue;
-	  }
-	}
+  fprintf (lr->fp, "        RECT %.6f %.6f %.6f %.6f ;\n",
+	   lr->scale*b->llx(i), lr->scale*b->lly(i),
+	   lr->scale*(1+b->urx(i)), lr->scale*(1+b->ury(i)));
+}
 
-	if (first) {
-	  if (!emit_obs && io != NULL) {
-	    fprintf (fp, "    OBS\n");
-	    emit_obs = 1;
-	  }
-	  if (lname == lprev) {
-	    fprintf (fp, "        LAYER %s ;\n", lname->getViaName());
-	  }
-	  else {
-	    fprintf (fp, "        LAYER %s ;\n", lname->getRouteName());
-	  }
-	}
-	first = 0;
-	
-	tle->m.apply (tmp->getllx(), tmp->getlly(), &tllx, &tlly);
-	tle->m.apply (tmp->geturx(), tmp->getury(), &turx, &tury);
+/*
+ * The rectangles of net are snap->getNet(start) .. getNet(end-1);
+ * their boxes under m go into b, transformed in one pass
+ */
+static void net_boxes (const BlobSnapshot *snap, void *net, TransformMat *m,
+		       RectBatch *b, int *start, int *end)
+{
+  snap->netRange (net, start, end);
+  b->clear ();
+  for (int k=*start; k < *end; k++) {
+    const struct blob_rect *r = snap->getNet (k);
+    b->add (r->llx, r->lly, r->urx, r->ury);
+  }
+  b->apply (m);
+}
 
-	if (tllx > turx) {
-	  long x = tllx;
-	  tllx = turx;
-	  turx = x;
-	}
-	  
-	if (tlly > tury) {
-	  long x = tlly;
-	  tlly = tury;
-	  tury = x;
-	}
-	
-	fprintf (fp, "        RECT %.6f %.6f %.6f %.6f ;\n",
-		 scale*tllx, scale*tlly, scale*(1+turx), scale*(1+tury));
+/*
+ * kind is BLOB_SEARCH_NET for the metal and vias of net, or
+ * BLOB_SEARCH_METAL for all metal (no vias)
+ */
+static int emit_layer_rects (FILE *fp, LayoutBlob *blob, blob_search kind,
+			     void *net, TransformMat *m,
+			     node_t **io = NULL, int num_io = 0)
+{
+  const BlobSnapshot *snap = blob->freeze ();
+  struct layer_rects lr;
+  RectBatch b;
+
+  lr.fp = fp;
+  lr.scale = Technology::T->scale/1000.0;
+  lr.io = io;
+  lr.num_io = num_io;
+  lr.emit_obs = 0;
+  lr.lprev = NULL;
+  lr.vprev = 0;
+  if (kind == BLOB_SEARCH_NET) {
+    int start, end;
+    net_boxes (snap, net, m, &b, &start, &end);
+    for (int k=start; k < end; k++) {
+      emit_layer_rect (&lr, snap->getNet (k), &b, k - start);
+    }
+  }
+  else {
+    int j;
+    for (int i=0; i < snap->length(); i++) {
+      const struct blob_rect *r = snap->get (i);
+      if (!r->via) {
+	b.add (r->llx, r->lly, r->urx, r->ury);
+      }
+    }
+    b.apply (m);
+    j = 0;
+    for (int i=0; i < snap->length(); i++) {
+      if (!snap->get (i)->via) {
+	emit_layer_rect (&lr, snap->get (i), &b, j++);
       }
-      lprev = lname;
     }
   }
-  return emit_obs;
+  return lr.emit_obs;
 }
 
-static void emit_antenna_area (FILE *fp, list_t *tiles)
-{
-  double scale = Technology::T->scale/1000.0;
-  listitem_t *tli;
-  double ant_area = 0.0;
-  double ant_diffarea = 0.0;
+struct antenna_area {
+  double scale;
+  double ant_area;
+  double ant_diffarea;
+};
 
-  for (tli = list_first (tiles); tli; tli = list_next (tli)) {
-    struct tile_listentry *tle = (struct tile_listentry *) list_value (tli);
-    listitem_t *xi;
+/* b(i) is r transformed into LEF coordinates */
+static void antenna_rect (struct antenna_area *aa,
+			  const struct blob_rect *r, RectBatch *b, int i)
+{
+  Tile *tmp = r->t;
+  double scale = aa->scale;
+  long tllx, tlly, turx, tury;
 
-    for (xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
-      Layer *lname = (Layer *) list_value (xi);
-      xi = list_next (xi);
-      Assert (xi, "Hmm");
+  if (r->l->isMetal() || r->via) {
+    return;
+  }
+  if (!tmp->isFet() && !tmp->isDiff()) {
+    return;
+  }
 
-      if (lname->isMetal()) {
-	continue;
-      }
+  tllx = b->llx(i);
+  tlly = b->lly(i);
+  turx = b->urx(i);
+  tury = b->ury(i);
 
-      list_t *actual_tiles = (list_t *) list_value (xi);
-      listitem_t *ti;
-      int first = 1;
-      
-      for (ti = list_first (actual_tiles); ti; ti = list_next (ti)) {
-	long tllx, tlly, turx, tury;
-	Tile *tmp = (Tile *) list_value (ti);
+  if (tmp->isFet()) {
+    aa->ant_area += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
+  }
+  else {
+    aa->ant_diffarea += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
+  }
+}
 
-	tle->m.apply (tmp->getllx(), tmp->getlly(), &tllx, &tlly);
-	tle->m.apply (tmp->geturx(), tmp->getury(), &turx, &tury);
-	
-	if (tllx > turx) {
-	  long x = tllx;
-	  tllx = turx;
-	  turx = x;
-	}
+static void emit_antenna_area (FILE *fp, LayoutBlob *blob, void *net,
+			       TransformMat *m)
+{
+  const BlobSnapshot *snap = blob->freeze ();
+  struct antenna_area aa;
+  RectBatch b;
+  int start, end;
 
-	if (tlly > tury) {
-	  long x = tlly;
-	  tlly = tury;
-	  tury = x;
-	}
-	
-	if (tmp->isFet()) {
-	  ant_area += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
-	}
-	else if (tmp->isDiff()) {
-	  ant_diffarea += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
-	}
-      }
-    }
+  aa.scale = Technology::T->scale/1000.0;
+  aa.ant_area = 0.0;
+  aa.ant_diffarea = 0.0;
+  net_boxes (snap, net, m, &b, &start, &end);
+  for (int k=start; k < end; k++) {
+    antenna_rect (&aa, snap->getNet (k), &b, k - start);
   }
-  if (ant_area > 0) {
-    fprintf (fp, "        ANTENNAGATEAREA %.6f ;\n", ant_area);
+
+  if (aa.ant_area > 0) {
+    fprintf (fp, "        ANTENNAGATEAREA %.6f ;\n", aa.ant_area);
   }
-  if (ant_diffarea > 0) {
-    fprintf (fp, "        ANTENNADIFFAREA %.6f ;\n", ant_diffarea);
+  if (aa.ant_diffarea > 0) {
+    fprintf (fp, "        ANTENNADIFFAREA %.6f ;\n", aa.ant_diffarea);
   }
 }  
 
@@ -2235,15 +2563,12 @@ static void emit_one_pin (Act *a, FILE *fp, const char *name, int isinput,
   /* -- find all pins of this name! -- */
   TransformMat mat;
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
-  list_t *tiles = blob->search (signode, &mat);
-  emit_layer_rects (fp, tiles);
+  emit_layer_rects (fp, blob, BLOB_SEARCH_NET, signode, &mat);
 
   fprintf (fp, "        END\n");
 
   // now we emit just the fet area for antennas
-  emit_antenna_area (fp, tiles);
-
-  LayoutBlob::searchFree (tiles);
+  emit_antenna_area (fp, blob, signode, &mat);
 
   fprintf (fp, "    END ");
   a->mfprintf (fp, "%s", name);
@@ -2555,15 +2880,13 @@ int ActStackLayout::_emitlocalLEF (Process *p)
   /* read non-pin metal */
 
   if (blob->getRead ()) {
-    list_t *l;
     Rectangle bloatbox = blob->getBloatBBox ();
     TransformMat mat;
     mat.translate (-bloatbox.llx(), -bloatbox.lly());
-    l = blob->searchAllMetal (&mat);
-    if (emit_layer_rects (fp, l, iopins, A_LEN (iopins))) {
+    if (emit_layer_rects (fp, blob, BLOB_SEARCH_METAL, NULL, &mat,
+			  iopins, A_LEN (iopins))) {
       fprintf (fp, "    END\n");
     }
-    LayoutBlob::searchFree (l);
   }
   else {
     /* XXX: add obstructions for metal layers; in reality we need to
@@ -2614,18 +2937,46 @@ void ActStackLayout::_computeWell (LayoutBlob *blob, int flavor, int type,
   Rectangle bloatbox = blob->getBloatBBox ();
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
 
-  list_t *tiles;
+  int attr;
   if (is_welltap) {
-    tiles = blob->search (TILE_FLGS_TO_ATTR(flavor,type,WDIFF_OFFSET), &mat);
+    attr = TILE_FLGS_TO_ATTR(flavor,type,WDIFF_OFFSET);
   }
   else {
-    tiles = blob->search (TILE_FLGS_TO_ATTR(flavor,type,DIFF_OFFSET), &mat);
+    attr = TILE_FLGS_TO_ATTR(flavor,type,DIFF_OFFSET);
   }
   
   long wllx, wlly, wurx, wury;
-
-  LayoutBlob::searchBBox (tiles, &wllx, &wlly, &wurx, &wury);
-  LayoutBlob::searchFree (tiles);
+  const BlobSnapshot *snap = blob->freeze ();
+
+  /* the diffusion is on the base layer */
+  wllx = 0;
+  wlly = 0;
+  wurx = -1;
+  wury = -1;
+  for (int i=0; i < snap->length(); i++) {
+    const struct blob_rect *r = snap->get (i);
+    if (r->via || r->l->isMetal() || r->t->getAttr() != attr) {
+      continue;
+    }
+    if (wllx > wurx) {
+      wllx = r->llx;
+      wlly = r->lly;
+      wurx = r->urx;
+      wury = r->ury;
+    }
+    else {
+      wllx = MIN (wllx, r->llx);
+      wlly = MIN (wlly, r->lly);
+      wurx = MAX (wurx, r->urx);
+      wury = MAX (wury, r->ury);
+    }
+  }
+  if (wllx <= wurx) {
+    /* exclusive upper coordinates */
+    mat.applyBoxes (1, &wllx, &wlly, &wurx, &wury);
+    wurx++;
+    wury++;
+  }
   if (wurx >= wllx) {
     /* bloat the region based on well overhang */
     if (is_welltap) {
@@ -3645,11 +3996,17 @@ LayoutBlob *ActStackLayout::computeLEFBoundary (LayoutBlob *b)
 
   Assert (Technology::T->nmetals >= 3, "Hmm");
 
-  nllx = snap_dn_x (bloatbox.llx()) - _extra_tracks_left*_m_align_x->getPitch();
-  nurx = snap_up_x (bloatbox.urx()+1)-1 + _extra_tracks_right*_m_align_x->getPitch();
+  nllx = bloatbox.llx();
+  nlly = bloatbox.lly();
+  nurx = bloatbox.urx();
+  nury = bloatbox.ury();
+  snapBBox (&nllx, &nlly, &nurx, &nury);
+
+  nllx -= _extra_tracks_left*_m_align_x->getPitch();
+  nurx += -1 + _extra_tracks_right*_m_align_x->getPitch();
 
-  nlly = snap_dn_y (bloatbox.lly()) - _extra_tracks_bot*_m_align_y->getPitch();
-  nury = snap_up_y (bloatbox.ury()+1)-1 + _extra_tracks_top*_m_align_y->getPitch();
+  nlly -= _extra_tracks_bot*_m_align_y->getPitch();
+  nury += -1 + _extra_tracks_top*_m_align_y->getPitch();
 
   LayoutBlob *box = new LayoutBlob (BLOB_BASE, NULL);
   box->setBBox (nllx, nlly, nurx, nury);
@@ -3698,124 +4055,146 @@ LayoutBlob *ActStackLayout::computeLEFBoundary (LayoutBlob *b)
  * Assumed that if there is a notch, then the poly overhang out of the
  * notch is not more than the normal poly overhang...
  */
-int ActStackLayout::_localdiffspace (Process *p)
+/*
+ * Geometry of each fet in a stack. gprev tracks the previous fet on
+ * the same side of the stack, which sets the spacing.
+ */
+static struct stk_egeom *stk_geom (int len, struct stk_entry *s, double la)
+{
+  struct stk_egeom *g, *gprev;
+  PolyMat *p = Technology::T->poly;
+
+  MALLOC (g, struct stk_egeom, len);
+  gprev = NULL;
+  for (int i=0; i < len; i++) {
+    edge_t *e = s[i].e;
+    if (!e) {
+      g[i].w = 0;
+      g[i].w0 = 0;
+      g[i].l = 0;
+      g[i].spc = 0;
+      g[i].ovh = 0;
+      g[i].notch_ovh = 0;
+      continue;
+    }
+    FetMat *f = Technology::T->fet[e->type][e->flavor];
+
+    g[i].w = getwidth (s[i].fold, e);
+    g[i].w0 = getwidth (0, e);
+    g[i].l = getlength (e, la);
+    g[i].spc = MAX (f->getSpacing (g[i].l), p->getSpacing (g[i].l));
+    if (gprev) {
+      g[i].spc = MAX (g[i].spc, MAX (f->getSpacing (gprev->l),
+				     p->getSpacing (gprev->l)));
+    }
+    g[i].ovh = p->getOverhang (g[i].l);
+    g[i].notch_ovh = p->getNotchOverhang (g[i].l);
+    gprev = &g[i];
+  }
+  return g;
+}
+
+/*
+ * The stack geometry of a process is computed once, and shared by
+ * the diffusion spacing computation and all the drawing routines.
+ * NULL if the process has no stacks.
+ */
+struct layout_geom *ActStackLayout::_geom (Process *p)
 {
+  phash_bucket_t *b;
+  struct layout_geom *g;
   int poly_potential;
-  int spc_default, spc2;
+  int spc_default;
   int flavor = -1;
   int poly_overhang;
   PolyMat *pmat = Technology::T->poly;
-  listitem_t *stki;
 
-  list_t *stks = (list_t *)stk->getMap (p);
+  if (!geomH) {
+    geomH = phash_new (4);
+  }
+  b = phash_lookup (geomH, p);
+  if (b) {
+    return (struct layout_geom *) b->v;
+  }
+  b = phash_add (geomH, p);
+  b->v = NULL;
+
+  struct stk_result *stks = (struct stk_result *)stk->getMap (p);
   netlist_t *n = nl->getNL (p);
 
   double la = n->leak_correct ? Layout::getLeakAdjust() : 0;
   
-  if (!stks || list_length (stks) == 0) {
-    return 0;
+  if (!stks) {
+    return NULL;
   }
 #if 0
-  printf ("computing local diffspace for %s...\n", p->getName());
+  printf ("computing local geometry for %s...\n", p->getName());
 #endif
-  
+
+  NEW (g, struct layout_geom);
+  MALLOC (g->dn, struct stk_egeom *, stks->ndual + 1);
+  MALLOC (g->dp, struct stk_egeom *, stks->ndual + 1);
+  MALLOC (g->n, struct stk_egeom *, stks->nn + 1);
+  MALLOC (g->p, struct stk_egeom *, stks->np + 1);
+  b->v = g;
+
   spc_default = 0;
   poly_overhang = 0;
 
-  stki = list_first (stks);
-  list_t *stklist = (list_t *) list_value (stki);
-
   poly_potential = 0;
   
-  if (list_length (stklist) > 0) {
-    listitem_t *si;
-    /* dual stacks */
-
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      struct gate_pairs *gp;
-      gp = (struct gate_pairs *) list_value (si);
-      if (gp->basepair) {
-	if (gp->u.e.n && gp->u.e.p) {
-	  poly_overhang = MAX (poly_overhang,
-			       pmat->getOverhang (getlength (gp->u.e.n, la)));
-	  poly_overhang = MAX (poly_overhang,
-			       pmat->getOverhang (getlength (gp->u.e.p, la)));
-	  if (gp->u.e.n->g != gp->u.e.p->g) {
-	    poly_potential = 1;
-	  }
+  /* dual stacks */
+  for (int si=0; si < stks->ndual; si++) {
+    struct stk_dual *gp = &stks->dual[si];
+    g->dn[si] = stk_geom (gp->len, gp->n, la);
+    g->dp[si] = stk_geom (gp->len, gp->p, la);
+    for (int i=0; i < gp->len; i++) {
+      edge_t *en = gp->n[i].e;
+      edge_t *ep = gp->p[i].e;
+      if (en && ep) {
+	poly_overhang = MAX (poly_overhang, g->dn[si][i].ovh);
+	poly_overhang = MAX (poly_overhang, g->dp[si][i].ovh);
+	if (en->g != ep->g) {
+	  poly_potential = 1;
 	}
-	if (gp->u.e.n) {
-	  if (flavor != gp->u.e.n->flavor) {
-	    flavor = gp->u.e.n->flavor;
-	    int x = Technology::T->diff[EDGE_NFET][flavor]->getOppDiffSpacing(flavor);
-	    spc_default = MAX (spc_default, x);
-	  }
-	}
-	if (gp->u.e.p) {
-	  if (flavor != gp->u.e.n->flavor) {
-	    flavor = gp->u.e.n->flavor;
-	    int x = Technology::T->diff[EDGE_PFET][flavor]->getOppDiffSpacing(flavor);
-	    spc_default = MAX (spc_default, x);
-	  }
+      }
+      if (en) {
+	if (flavor != en->flavor) {
+	  flavor = en->flavor;
+	  int x = Technology::T->diff[EDGE_NFET][flavor]->getOppDiffSpacing(flavor);
+	  spc_default = MAX (spc_default, x);
 	}
       }
-      else {
-	listitem_t *li;
-	for (li = list_first (gp->u.gp); li; li = list_next (li)) {
-	  struct gate_pairs *tmp;
-	  tmp = (struct gate_pairs *) list_value (li);
-	  Assert (tmp->basepair, "What?");
-	  if (tmp->u.e.n && tmp->u.e.p) {
-	    poly_overhang = MAX (poly_overhang,
-				 pmat->getOverhang (getlength (tmp->u.e.n, la)));
-	    poly_overhang = MAX (poly_overhang,
-				 pmat->getOverhang (getlength (tmp->u.e.p, la)));
-				 
-	    if (tmp->u.e.n->g != tmp->u.e.p->g) {
-	      poly_potential = 1;
-	    }
-	  }
-	  if (tmp->u.e.n) {
-	    if (flavor != tmp->u.e.n->flavor) {
-	      flavor = tmp->u.e.n->flavor;
-	      int x = Technology::T->diff[EDGE_NFET][flavor]->getOppDiffSpacing(flavor);
-	      spc_default = MAX (spc_default, x);
-	    }
-	  }
-	  if (tmp->u.e.p) {
-	    if (flavor != tmp->u.e.p->flavor) {
-	      flavor = tmp->u.e.p->flavor;
-	      int x = Technology::T->diff[EDGE_PFET][flavor]->getOppDiffSpacing(flavor);
-	      spc_default = MAX (spc_default, x);
-	    }
-	  }
+      if (ep) {
+	if (flavor != ep->flavor) {
+	  flavor = ep->flavor;
+	  int x = Technology::T->diff[EDGE_PFET][flavor]->getOppDiffSpacing(flavor);
+	  spc_default = MAX (spc_default, x);
 	}
       }
     }
   }
 
-  stki = list_next (stki);
-  stklist = (list_t *) list_value (stki);
- 
-  if (stklist && list_length (stklist) > 0) {
-    list_t *l = (list_t *) list_value (list_first (stklist));
-    edge_t *e = (edge_t *) list_value (list_next (list_first (l)));
+  for (int si=0; si < stks->nn; si++) {
+    g->n[si] = stk_geom (stks->n[si].len, stks->n[si].s, la);
+  }
+  for (int si=0; si < stks->np; si++) {
+    g->p[si] = stk_geom (stks->p[si].len, stks->p[si].s, la);
+  }
+
+  if (stks->nn > 0) {
+    edge_t *e = stks->n[0].s[0].e;
     int x = Technology::T->diff[EDGE_NFET][e->flavor]->getOppDiffSpacing(e->flavor);
     spc_default = MAX (spc_default, x);
   }
 
-  stki = list_next (stki);
-  list_t *stklist2 = (list_t *)  list_value (stki);
-
-  if (stklist2 && list_length (stklist2) > 0) {
-    list_t *l = (list_t *) list_value (list_first (stklist2));
-    edge_t *e = (edge_t *) list_value (list_next (list_first (l)));
+  if (stks->np > 0) {
+    edge_t *e = stks->p[0].s[0].e;
     int x = Technology::T->diff[EDGE_NFET][e->flavor]->getOppDiffSpacing(e->flavor);
     spc_default = MAX (spc_default, x);
   }
 
-  if (stklist && stklist2 &&
-      list_length (stklist) > 0 && list_length (stklist2) > 0) {
+  if (stks->nn > 0 && stks->np > 0) {
     poly_potential = 1;
   }
   
@@ -3830,23 +4209,24 @@ int ActStackLayout::_localdiffspace (Process *p)
 #if 0
   printf (" final = %d\n", spc_default);
 #endif  
-  return spc_default;
+  g->diffspace = spc_default;
+  return g;
 }
 
-int ActStackLayout::isEmpty (list_t *stk)
+int ActStackLayout::_localdiffspace (Process *p)
 {
-  if (!stk) return 1;
-  
-  list_t *dual, *n, *p;
-  
-  dual = (list_t *) list_value (list_first (stk));
-  n = (list_t *) list_value (list_next (list_first (stk)));
-  p = (list_t *) list_value (list_next (list_next (list_first (stk))));
+  struct layout_geom *g = _geom (p);
 
-  if (list_length (dual) > 0) return 0;
-  if (n && list_length (n) > 0) return 0;
-  if (p && list_length (p) > 0) return 0;
-  
+  if (!g) {
+    return 0;
+  }
+  return g->diffspace;
+}
+
+int ActStackLayout::isEmpty (struct stk_result *stk)
+{
+  if (!stk) return 1;
+  if (stk->ndual > 0 || stk->nn > 0 || stk->np > 0) return 0;
   return 1;
 }
 
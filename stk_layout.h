@@ -24,12 +24,38 @@
 
 #include <act/act.h>
 #include <map>
-#include <unordered_set>
 #include "geom.h"
+#include "grid.h"
 #include <common/path.h>
 
 /*-- data structures --*/
 
+struct stk_result;
+
+/* cached layout state for a process */
+struct layout_cache_info {
+  unsigned long fp;		// fingerprint of current netlist
+  int valid;			// 1 if the cached layout matches
+  int diffspace;		// cached diffusion spacing
+};
+
+/* geometry of one fet in a stack, in layout units */
+struct stk_egeom {
+  int w;			// width of this fold
+  int w0;			// width of fold 0
+  int l;			// length, with leakage adjustment
+  int spc;			// fet/poly spacing from the previous fet
+  int ovh;			// poly overhang
+  int notch_ovh;		// poly overhang past a diffusion notch
+};
+
+/* geometry for all the stacks of a process; mirrors stk_result */
+struct layout_geom {
+  int diffspace;		// spacing between n and p diffusion
+  struct stk_egeom **dn, **dp;	// dual stacks
+  struct stk_egeom **n, **p;	// single stacks
+};
+
 class ActStackLayout {
 public:
   ActStackLayout (ActPass *a);
@@ -41,6 +67,11 @@ public:
   long snap_dn_x (long);
   long snap_dn_y (long);
 
+  /* snap a bloated bbox to the alignment grid, as used for the LEF
+     boundary; urx/ury are returned exclusive */
+  void snapBBox (long *llx, long *lly, long *urx, long *ury);
+  void snapBBox (int n, long *llx, long *lly, long *urx, long *ury);
+
   void *localop (ActPass *ap, Process *p, int mode);
 
   void run_post (void);
@@ -51,13 +82,25 @@ public:
   void incBBox (Process *p);
   long getBBoxCount (Process *p);
 
+  /* 1 if the cached layout for p is up to date */
+  int cacheValid (Process *p);
+
  private:
   int _localdiffspace (Process *p);
 
+  struct pHashtable *geomH;	// map from process to layout_geom
+  struct layout_geom *_geom (Process *p);
+
   LayoutBlob *_readlocalRect (Process *p);
+  LayoutBlob *_readRect (Process *p, const char *fname, int diffspace);
 
   /* mode 0 */
-  LayoutBlob *_createlocallayout (Process *p);
+  LayoutBlob *_createlocallayout (Process *p, netlist_t **supply);
+
+  int _threads;			// # of threads for mode 0
+  struct pHashtable *parH;	// process to layout blob, when
+				// computed in parallel
+  void _createparallel ();
 
   /* mode 1 */
   int _lef_header;
@@ -88,11 +131,18 @@ public:
   /* welltap */
   LayoutBlob **wellplugs;
   netlist_t *dummy_netlist;	// dummy netlist
+  void _setdummy (netlist_t *n);
 
   LayoutBlob *_createwelltap (int flavor);
   LayoutBlob *_readwelltap (int flavor);
   void _emitwelltaprect (int flavor);
 
+  /* welltap entries in the layout cache */
+  unsigned long _welltapfp (int flavor);
+  unsigned long _cellfp (Process *p);
+  LayoutBlob *_readcachedwelltap (int flavor);
+  void _writecachedwelltap (int flavor, LayoutBlob *b);
+
 
   /* aligned LEF boundary */
   LayoutBlob *computeLEFBoundary (LayoutBlob *b);
@@ -103,7 +153,7 @@ public:
   /*-- bounding box for black boxes --*/
   struct pHashtable *boxH;
 
-  int isEmpty (list_t *stk);
+  int isEmpty (struct stk_result *stk);
 
   Act *a;
   ActPass *me;
@@ -126,10 +176,13 @@ public:
   double _manufacturing_grid;
   RoutingMat *_m_align_x;
   RoutingMat *_m_align_y;
+  GridSnap _snap_x, _snap_y;	// snapping to the alignment pitches
   int _horiz_metal;
   int _pin_layer;
   RoutingMat *_pin_metal;
   int _rect_wells;
+  int _flatten_stacks;		// 1 if all stacks in a cell share one
+				// Layout
 
   /* -- .rect file management -- */
   int _rect_import;  /* set to 1 if .rects can be read in from files,
@@ -139,12 +192,18 @@ public:
   const char *_rect_outinitdir; // rect output directory for initial
 				// unwired layout
 
+  /* -- incremental layout cache -- */
+  const char *_cache_dir;	// cache directory, if any
+  struct pHashtable *cacheH;	// map from process to layout_cache_info
+  struct layout_cache_info *_cacheinfo (Process *p);
+  void _cachename (Process *p, const char *ext, char *buf, int sz);
+  LayoutBlob *_readcached (Process *p);
+  void _writecache (Process *p, LayoutBlob *blob, TransformMat *mat);
+
   int _extra_tracks_top;
   int _extra_tracks_bot;
   int _extra_tracks_left;
   int _extra_tracks_right;
-
-  std::unordered_set<Process *> *visited;
 };
 
 extern "C" {
@@ -19,8 +19,14 @@
  *
  **************************************************************************
  */
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <set>
 #include <common/heap.h>
 #include "stk_pass.h"
+#include "fnv.h"
 #include <common/config.h>
 
 #ifndef MIN
@@ -274,7 +280,7 @@ static void node_degree (node_t *n, int *pcnt, int *ncnt)
 /*
  * Search for gate pair to see if it is already in the heap
  */
-static int find_pairs (Heap *h, struct gate_pairs *p)
+static int find_pairs (Heap *h, struct gate_pairs *p, struct stk_stats *st)
 {
   struct gate_pairs *x;
 
@@ -285,8 +291,10 @@ static int find_pairs (Heap *h, struct gate_pairs *p)
       listitem_t *li, *mi;
       if (x->l == p->l) {
 	if (x->basepair) {
-	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p)
+	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p) {
+	    st->dup_pairs++;
 	    return 1;
+	  }
 	}
 	else {
 	  for (li = list_first (x->u.gp), mi = list_first (p->u.gp); 
@@ -295,25 +303,30 @@ static int find_pairs (Heap *h, struct gate_pairs *p)
 	      break;
 	    }
 	  }
-	  if (!li || !mi) return 1;
+	  if (!li || !mi) {
+	    st->dup_pairs++;
+	    return 1;
+	  }
 	}
       }
       else if (x->l == p->r) {
 	if (x->basepair) {
-	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p)
+	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p) {
+	    st->dup_pairs++;
 	    return 1;
+	  }
 	}
 	else {
-	  list_t *rp;
-	  rp = list_dup (p->u.gp);
-	  list_reverse (rp);
 	  for (li = list_first (x->u.gp), mi = list_first (p->u.gp); 
 	       li && mi; li = list_next (li), mi = list_next (mi)) {
 	    if (list_value (li) != list_value (mi))  {
 	      break;
 	    }
 	  }
-	  if (!li || !mi) return 1;
+	  if (!li || !mi) {
+	    st->dup_pairs++;
+	    return 1;
+	  }
 	}
       }
     }
@@ -323,14 +336,97 @@ static int find_pairs (Heap *h, struct gate_pairs *p)
 
 
 /*
- * release storage for gate pair
+ * Storage for stacking one process. All gate pairs, gate pair lists
+ * and the final stacks created by stk_proc() are owned by the arena,
+ * and released in one shot by stk_free().
  */
-static void delete_pair (struct gate_pairs *p)
+#define STK_ARENA_BLOCK 16384
+#define STK_ARENA_ALIGN(x)  (((x) + 15) & ~((size_t)15))
+
+struct stk_block {
+  struct stk_block *next;
+  size_t used, sz;		// bytes used/available after the header
+};
+
+struct stk_arena {
+  struct stk_block *hd;
+  A_DECL (list_t *, lists);
+};
+
+static struct stk_arena *stk_arena_new (void)
 {
-  if (!p->basepair)  {
-    list_free (p->u.gp);
+  struct stk_arena *A;
+
+  NEW (A, struct stk_arena);
+  A->hd = NULL;
+  A_INIT (A->lists);
+  return A;
+}
+
+static void *stk_arena_alloc (struct stk_arena *A, size_t sz)
+{
+  const size_t hdr = STK_ARENA_ALIGN (sizeof (struct stk_block));
+  struct stk_block *b;
+  char *mem;
+
+  sz = STK_ARENA_ALIGN (sz);
+  if (!A->hd || A->hd->used + sz > A->hd->sz) {
+    size_t bsz = (sz > STK_ARENA_BLOCK ? sz : STK_ARENA_BLOCK);
+    MALLOC (mem, char, hdr + bsz);
+    b = (struct stk_block *) mem;
+    b->used = 0;
+    b->sz = bsz;
+    b->next = A->hd;
+    A->hd = b;
   }
-  FREE (p);
+  mem = ((char *)A->hd) + hdr + A->hd->used;
+  A->hd->used += sz;
+  return mem;
+}
+
+static struct gate_pairs *stk_pair_new (struct stk_arena *A)
+{
+  return (struct gate_pairs *) stk_arena_alloc (A, sizeof (struct gate_pairs));
+}
+
+static list_t *stk_list_track (struct stk_arena *A, list_t *l)
+{
+  A_NEW (A->lists, list_t *);
+  A_NEXT (A->lists) = l;
+  A_INC (A->lists);
+  return l;
+}
+
+static list_t *stk_list_new (struct stk_arena *A)
+{
+  return stk_list_track (A, list_new ());
+}
+
+static list_t *stk_list_dup (struct stk_arena *A, list_t *l)
+{
+  return stk_list_track (A, list_dup (l));
+}
+
+static void stk_arena_free_lists (struct stk_arena *A)
+{
+  for (int i=0; i < A_LEN (A->lists); i++) {
+    list_free (A->lists[i]);
+  }
+  A_FREE (A->lists);
+  A_INIT (A->lists);
+}
+
+static void stk_arena_free (struct stk_arena *A)
+{
+  struct stk_block *b;
+  
+  stk_arena_free_lists (A);
+  while (A->hd) {
+    b = A->hd;
+    A->hd = b->next;
+    FREE (b);
+  }
+  FREE (A);
 }
 
 static int available_edge (edge_t *e)
@@ -341,7 +437,8 @@ static int available_edge (edge_t *e)
 
 /* dir = 0, add to front; dir = 1, add to end */
 static void extend_gatepair (netlist_t *N, struct gate_pairs **gpp,
-			     int dir)
+			     int dir, struct stk_arena *A,
+			     struct stk_stats *st)
 {
   int tryn, tryp;
   edge_t *en, *ep;
@@ -357,6 +454,7 @@ static void extend_gatepair (netlist_t *N, struct gate_pairs **gpp,
   gp = *gpp;
 
   while (tryn || tryp) {
+    st->extend_iter++;
     other.n = NULL;
     other.p = NULL;
     sn = NULL;
@@ -438,7 +536,7 @@ static void extend_gatepair (netlist_t *N, struct gate_pairs **gpp,
     if (!other.p) tryp = 0;
 
     struct gate_pairs *tmp;
-    NEW (tmp, struct gate_pairs);
+    tmp = stk_pair_new (A);
     tmp->basepair = 1;
     tmp->visited = 1;
     tmp->u.e.n = sn;
@@ -479,9 +577,9 @@ static void extend_gatepair (netlist_t *N, struct gate_pairs **gpp,
 
     if (gp->basepair) {
       struct gate_pairs *t2;
-      NEW (t2, struct gate_pairs);
+      t2 = stk_pair_new (A);
       *t2 = *gp;
-      t2->u.gp = list_new ();
+      t2->u.gp = stk_list_new (A);
       t2->basepair = 0;
       t2->visited = 0;
       list_append (t2->u.gp, gp);
@@ -499,147 +597,463 @@ static void extend_gatepair (netlist_t *N, struct gate_pairs **gpp,
   return;
 }
 
-static node_t *pick_node_odd_degree (list_t *lst, int type)
+/*
+ * Single stacks are computed as Euler paths through the n or p
+ * diffusion graph using Hierholzer's algorithm.
+ *
+ * Each available fet is one edge, consumed with all its remaining
+ * folds. A fet with an odd number of remaining folds goes from one
+ * terminal to the other; with an even number it starts and ends on
+ * the same node, so it acts like a self-loop that can be attached at
+ * either terminal.
+ *
+ * Odd-degree nodes of each connected component are paired up with
+ * virtual edges (e == NULL) so that the component has an Euler
+ * circuit. Cutting the circuit at the virtual edges gives the minimum
+ * number of diffusion strips for the component.
+ *
+ * The walk makes the same choices as the old greedy walk: components
+ * start at the first node with an odd number of fets, and each step
+ * prefers the first fet (in the node's edge list) that does not lead
+ * to a dead end. So a component the greedy walk covered with one
+ * stack gives the same stack as before.
+ *
+ * Each fet entry in a node's adjacency is scanned, set aside as a
+ * dead end, and taken at most once, so the walk is linear in the
+ * number of fets. Start nodes are kept in ordered sets, updated once
+ * per walk for each node whose fet count changed.
+ */
+struct euler_edge {
+  edge_t *e;			// NULL for a virtual edge
+  int a, b;			// node indices
+  unsigned int loop:1;		// returns to the node it started from
+  unsigned int used:1;		// already part of a stack
+};
+
+static int euler_root (std::vector<int> &parent, int x)
 {
-  edge_t *e;
-  node_t *n;
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
+
+/* node u lost d fet entries; the start sets are fixed up after the
+   walk, once per touched node */
+static void euler_deg (std::vector<int> &deg, std::vector<char> &mark,
+		       std::vector<int> &touched, int u, int d)
+{
+  if (d == 0) {
+    return;
+  }
+  deg[u] -= d;
+  if (!mark[u]) {
+    mark[u] = 1;
+    touched.push_back (u);
+  }
+}
+
+static void euler_emit (std::vector<struct stk_entry> &onestk,
+			edge_t *e, node_t *n)
+{
+  struct stk_entry x;
+  x.e = e;
+  x.fold = e->visited;
+  x.n = n;
+  e->visited = e->nfolds;
+  onestk.push_back (x);
+}
+
+static void euler_stack (std::vector<struct stk_single> &stks,
+			 node_t *left, std::vector<struct stk_entry> &onestk,
+			 struct stk_arena *A)
+{
+  struct stk_single s;
+  s.left = left;
+  s.len = onestk.size();
+  s.s = (struct stk_entry *)
+    stk_arena_alloc (A, sizeof (struct stk_entry)*s.len);
+  for (int i=0; i < s.len; i++) {
+    s.s[i] = onestk[i];
+  }
+  stks.push_back (s);
+  onestk.clear ();
+}
+
+static void compute_raw_stacks (netlist_t *N, list_t *l, int type,
+				struct stk_arena *A,
+				int *nstks, struct stk_single **ret)
+{
+  std::unordered_map<node_t *, int> idx;
+  std::unordered_map<edge_t *, int> eidx;
+  std::vector<node_t *> nodes;
+  std::vector<struct euler_edge> edges;
+  std::vector<struct stk_single> stks;
+  std::vector<struct stk_entry> onestk;
   listitem_t *li, *mi;
-  listitem_t *prev;
-  int deg;
+  int i, nv;
 
-  prev = NULL;
-  li = list_first (lst);
-  while (li) {
-    n = (node_t *) list_value (li);
-    deg = 0;
-    for (mi = list_first (n->e); mi; mi = list_next (mi)) {
-      e = (edge_t *) list_value (mi);
+#if 0
+  printf ("Type: %c\n", type == EDGE_PFET ? 'p' : 'n');
+#endif  
+
+  for (li = list_first (l); li; li = list_next (li)) {
+    node_t *n = (node_t *) list_value (li);
+    if (idx.find (n) == idx.end()) {
+      idx[n] = nodes.size();
+      nodes.push_back (n);
+    }
+  }
+  nv = nodes.size();
+
+  /*-- collect available edges, and adjacency in edge list order --*/
+  std::vector<int> start (nv+1, 0), adj, nreal (nv, 0), deg (nv, 0), nself;
+
+  for (i=0; i < nv; i++) {
+    start[i] = adj.size();
+    for (mi = list_first (nodes[i]->e); mi; mi = list_next (mi)) {
+      edge_t *e = (edge_t *) list_value (mi);
+      struct euler_edge x;
+      int av;
+      
       if (e->type != type) continue;
-      if (!available_edge (e)) continue;
-      deg++;
+      av = available_edge (e);
+      if (!av) continue;
+      deg[i]++;
+
+      auto it = eidx.find (e);
+      if (it != eidx.end()) {
+	/* the other terminal, unless it is listed twice here */
+	if (edges[it->second].a != edges[it->second].b) {
+	  adj.push_back (it->second);
+	  nreal[i]++;
+	}
+	else {
+	  nself[it->second]++;
+	}
+	continue;
+      }
+      Assert (idx.find (e->a) != idx.end() &&
+	      idx.find (e->b) != idx.end(), "Edge endpoint missing?");
+      x.e = e;
+      x.a = idx[e->a];
+      x.b = idx[e->b];
+      x.loop = ((av & 1) == 0 || x.a == x.b) ? 1 : 0;
+      x.used = 0;
+      eidx[e] = edges.size();
+      adj.push_back (edges.size());
+      nreal[i]++;
+      nself.push_back (1);
+      edges.push_back (x);
     }
-    if (deg == 0) {
-      /* remove node from the list */
-      li = list_next (li);
-      list_delete_next (lst, prev);
+  }
+  start[nv] = adj.size();
+  int nedges = edges.size();
+
+  /*-- connected components and odd-degree nodes --*/
+  std::vector<int> parent (nv), odd (nv, 0), pending (nv, -1);
+
+  for (i=0; i < nv; i++) {
+    parent[i] = i;
+  }
+  for (i=0; i < nedges; i++) {
+    int ra, rb;
+    if (edges[i].loop) continue;
+    odd[edges[i].a] ^= 1;
+    odd[edges[i].b] ^= 1;
+    ra = euler_root (parent, edges[i].a);
+    rb = euler_root (parent, edges[i].b);
+    if (ra != rb) {
+      parent[ra] = rb;
     }
-    else if (deg & 1) {
-      return n;
+  }
+  for (i=0; i < nv; i++) {
+    int r;
+    if (!odd[i]) continue;
+    r = euler_root (parent, i);
+    if (pending[r] == -1) {
+      pending[r] = i;
     }
     else {
-      prev = li;
-      li = list_next (li);
+      struct euler_edge x;
+      x.e = NULL;
+      x.a = pending[r];
+      x.b = i;
+      x.loop = 0;
+      x.used = 0;
+      edges.push_back (x);
+      pending[r] = -1;
     }
   }
-  /* none left, just take one that is even. doesn't matter */
-  li = list_first (lst);
-  if (li) {
-    return (node_t *) list_value (li);
+
+  /*-- virtual edges go after the fets of each node --*/
+  std::vector<int> vstart (nv+1, 0), vadj;
+  
+  for (i=nedges; i < (int)edges.size(); i++) {
+    vstart[edges[i].a+1]++;
+    vstart[edges[i].b+1]++;
   }
-  else {
-    return NULL;
+  for (i=0; i < nv; i++) {
+    vstart[i+1] += vstart[i];
   }
-}
-
-static edge_t *pick_candidate_edge (list_t *l, node_t *n, int type, node_t **otherp)
-{
-  listitem_t *li;
-  listitem_t *mi;
-  edge_t *e, *eopt;
-  node_t *other;
-  int av;
-
-  eopt = NULL;
-  other = NULL;
+  std::vector<int> cursor = vstart;
+  vadj.resize (vstart[nv]);
+  for (i=nedges; i < (int)edges.size(); i++) {
+    vadj[cursor[edges[i].a]++] = i;
+    vadj[cursor[edges[i].b]++] = i;
+  }
+  std::vector<int> vcursor = vstart;
+  cursor = start;
+
+  /*-- fets that lead to a dead end (the far node has no other fet
+       left) are moved from the cursor into a per-node bucket, and
+       only used once nothing else is left. A node's bucket shares
+       the node's slots in adj[], so each entry is scanned, bucketed
+       and popped at most once --*/
+  std::vector<int> dead (adj.size()), dtop = start;
+
+  /*-- the greedy walk started at the first node (in list order)
+       with an odd number of fet entries left, else the first node
+       with any; keep those nodes in ordered sets --*/
+  std::set<int> odd_start, any_start;
+  std::vector<char> mark (nv, 0);
+  std::vector<int> touched;
   
-  for (li = list_first (l); li; li = list_next (li)) {
-    e = (edge_t *) list_value (li);
-    if (e->type != type) continue;
-    av = available_edge (e);
-    if (!av) continue;
-
-    eopt = e;
+  for (i=0; i < nv; i++) {
+    if (deg[i] > 0) {
+      any_start.insert (i);
+    }
+    if (deg[i] & 1) {
+      odd_start.insert (i);
+    }
+  }
+  
+  /*-- walk each component --*/
+  std::vector<int> stk_n, stk_e, cn, ce;
+  
+  while (!any_start.empty()) {
+    int k, j;
     
-    if (e->a == n) {
-      if (av & 1) {
-	other = e->b;
+    stk_n.clear ();
+    stk_e.clear ();
+    cn.clear ();
+    ce.clear ();
+
+    if (!odd_start.empty()) {
+      stk_n.push_back (*odd_start.begin());
+    }
+    else {
+      stk_n.push_back (*any_start.begin());
+    }
+    stk_e.push_back (-1);
+    while (!stk_n.empty()) {
+      int u = stk_n.back();
+      int x = -1;
+
+      /* first fet that does not lead to a dead end... */
+      while (cursor[u] < start[u+1]) {
+	struct euler_edge *f = &edges[adj[cursor[u]]];
+	int w;
+	if (!f->used) {
+	  w = f->loop ? u : (f->a == u ? f->b : f->a);
+	  if (nreal[w] > 1) {
+	    x = adj[cursor[u]];
+	    break;
+	  }
+	  /* nreal[] never goes up, so it stays a dead end */
+	  dead[dtop[u]++] = adj[cursor[u]];
+	}
+	cursor[u]++;
+      }
+      /* ...else the last one */
+      if (x == -1) {
+	while (dtop[u] > start[u] && edges[dead[dtop[u]-1]].used) {
+	  dtop[u]--;
+	}
+	if (dtop[u] > start[u]) {
+	  x = dead[--dtop[u]];
+	}
+      }
+      if (x == -1) {
+	while (vcursor[u] < vstart[u+1] && edges[vadj[vcursor[u]]].used) {
+	  vcursor[u]++;
+	}
+	if (vcursor[u] < vstart[u+1]) {
+	  x = vadj[vcursor[u]];
+	}
+      }
+      if (x != -1) {
+	edges[x].used = 1;
+	if (edges[x].e) {
+	  nreal[edges[x].a]--;
+	  euler_deg (deg, mark, touched, edges[x].a, 1);
+	  if (edges[x].b != edges[x].a) {
+	    nreal[edges[x].b]--;
+	    euler_deg (deg, mark, touched, edges[x].b, 1);
+	  }
+	  else {
+	    euler_deg (deg, mark, touched, edges[x].a, nself[x] - 1);
+	  }
+	}
+	stk_n.push_back (edges[x].loop ? u :
+			 (edges[x].a == u ? edges[x].b : edges[x].a));
+	stk_e.push_back (x);
       }
       else {
-	other = e->a;
+	cn.push_back (u);
+	ce.push_back (stk_e.back());
+	stk_n.pop_back ();
+	stk_e.pop_back ();
       }
     }
-    else {
-      Assert (e->b == n, "Hmm");
-      if (av & 1) {
-	other = e->a;
+    for (int u : touched) {
+      if (deg[u] & 1) {
+	odd_start.insert (u);
       }
       else {
-	other = e->b;
+	odd_start.erase (u);
+      }
+      if (deg[u] == 0) {
+	any_start.erase (u);
       }
+      mark[u] = 0;
+    }
+    touched.clear ();
+    /* cn/ce are in reverse order: ce[t] is the edge into cn[t] */
+    k = ce.size() - 1;
+    if (k == 0) continue;
+    std::reverse (cn.begin(), cn.end());
+    std::reverse (ce.begin(), ce.end());
+    ce.erase (ce.begin());
+    
+    /* ce[t] now joins cn[t] and cn[t+1]; the walk is a closed
+       circuit, so start right after a virtual edge if there is one */
+    for (j=0; j < k; j++) {
+      if (!edges[ce[j]].e) break;
     }
-    for (mi = list_first (other->e); mi; mi = list_next (mi)) {
-      edge_t *f;
-      f = (edge_t *) list_value (mi);
-      if (f->type != type) continue;
-      if (f == e) continue;
-      if (available_edge (f)) {
-	break;
+    node_t *left = NULL;
+    
+    if (j == k) {
+      for (j=0; j < k; j++) {
+	euler_emit (onestk, edges[ce[j]].e, nodes[cn[j+1]]);
       }
+      euler_stack (stks, nodes[cn[0]], onestk, A);
     }
-    if (mi) {
-      *otherp = other;
-      return e;
+    else {
+      for (int t=1; t <= k; t++) {
+	int x = (j + t) % k;
+	if (!edges[ce[x]].e) {
+	  if (left) {
+	    euler_stack (stks, left, onestk, A);
+	  }
+	  left = NULL;
+	}
+	else {
+	  if (!left) {
+	    left = nodes[cn[x]];
+	  }
+	  euler_emit (onestk, edges[ce[x]].e, nodes[cn[x+1]]);
+	}
+      }
+      /* the last edge visited is the virtual edge j */
+      Assert (!left && onestk.empty(), "What?");
     }
   }
-  *otherp = other;
-  return eopt;
-}
 
+  *nstks = stks.size();
+  *ret = (struct stk_single *)
+    stk_arena_alloc (A, sizeof (struct stk_single)*stks.size());
+  for (i=0; i < (int)stks.size(); i++) {
+    (*ret)[i] = stks[i];
+  }
+}
 
-static list_t *compute_raw_stacks (netlist_t *N, list_t *l, int type)
+/*
+ * Fill in one side of a dual stack entry, walking from the node on
+ * the left of the fet to the node on its right.
+ */
+static void stk_set_entry (struct stk_entry *x, edge_t *e, int fold,
+			   node_t **left)
 {
-  node_t *n;
-  list_t *stks;
-  list_t *onestk;
-  edge_t *e;
-  node_t *other;
-
-  stks = list_new ();
-
-
-#if 0
-  printf ("Type: %c\n", type == EDGE_PFET ? 'p' : 'n');
-#endif  
+  x->e = e;
+  if (!e) {
+    x->fold = 0;
+    x->n = NULL;
+    return;
+  }
+  x->fold = fold;
+  if (e->a == *left) {
+    x->n = e->b;
+  }
+  else {
+    Assert (e->b == *left, "Hmm");
+    x->n = e->a;
+  }
+  *left = x->n;
+}
 
-  while ((n = pick_node_odd_degree (l, type))) {
-#if 0
-    printf ("candidate node: ");
-    dump_node (N, n);
-    printf ("\n");
-#endif
-    /* grab edges, walk the graph! */
-    onestk = list_new ();
-    list_append (onestk, n);
-    while ((e = pick_candidate_edge (n->e, n, type, &other))) {
-      list_append (onestk, e);
-      list_append (onestk, (void*)(long)e->visited);
-      e->visited = e->nfolds;
-      list_append (onestk, other);
-#if 0
-      printf ("\t edge: ");
-      dump_edge (N, e);
-      printf ("\n");
-#endif
-      n = other;
+/*
+ * Convert a (possibly composite) gate pair into a flat dual stack,
+ * with one entry per fold.
+ */
+static void stk_flatten_dual (struct gate_pairs *gp, struct stk_dual *d,
+			      struct stk_arena *A)
+{
+  listitem_t *li;
+  struct gate_pairs *tmp;
+  node_t *ln, *lp;
+  int k;
+
+  if (gp->basepair) {
+    d->len = gp->share;
+    li = NULL;
+    tmp = gp;
+  }
+  else {
+    d->len = 0;
+    for (li = list_first (gp->u.gp); li; li = list_next (li)) {
+      tmp = (struct gate_pairs *) list_value (li);
+      d->len += tmp->share;
     }
-    if (list_length (onestk) == 1) {
-      list_free (onestk);
+    li = list_first (gp->u.gp);
+    tmp = (struct gate_pairs *) list_value (li);
+  }
+  d->nleft = gp->l.n;
+  d->pleft = gp->l.p;
+  d->n = (struct stk_entry *)
+    stk_arena_alloc (A, sizeof (struct stk_entry)*d->len);
+  d->p = (struct stk_entry *)
+    stk_arena_alloc (A, sizeof (struct stk_entry)*d->len);
+
+  ln = gp->l.n;
+  lp = gp->l.p;
+  k = 0;
+  d->basepair = gp->basepair;
+  d->nlend = 0;
+  d->plend = 0;
+  while (tmp) {
+    Assert (tmp->basepair, "Hmm");
+    for (int i=0; i < tmp->share; i++) {
+      stk_set_entry (&d->n[k], tmp->u.e.n, tmp->n_start + i, &ln);
+      stk_set_entry (&d->p[k], tmp->u.e.p, tmp->p_start + i, &lp);
+      k++;
     }
-    else {
-      list_append (stks, onestk);
+    /* the LEFT flag covers the first fold of a base pair, and all
+       the folds of the first gate pair of a composite that has that
+       side */
+    if (!d->nlend && tmp->u.e.n) {
+      d->nlend = (gp->basepair ? 1 : k);
     }
+    if (!d->plend && tmp->u.e.p) {
+      d->plend = (gp->basepair ? 1 : k);
+    }
+    if (li) {
+      li = list_next (li);
+    }
+    tmp = li ? (struct gate_pairs *) list_value (li) : NULL;
   }
-  return stks;
+  Assert (k == d->len, "What?");
 }
 
 
@@ -682,9 +1096,30 @@ void stk_run (ActPass *ap, Process *p)
   /* nothing to do */
 }
 
-void stk_recursive (ActPass *ap, Process *p, int mode)
+/*
+ * mode 1: print stacking statistics as a table
+ * mode 2: print stacking statistics in JSON format
+ *
+ * Output goes to the "stats_file" parameter if set, stdout otherwise.
+ */
+void stk_recursive (ActPass *_ap, UserDef *u, int mode)
 {
-  /* nothing extra */
+  ActDynamicPass *ap = dynamic_cast<ActDynamicPass *> (_ap);
+  RawActStackPass *_sp;
+  FILE *fp;
+
+  if (mode != 1 && mode != 2) {
+    return;
+  }
+  Assert (ap, "What?");
+  _sp = (RawActStackPass *)ap->getPtrParam ("raw");
+  Assert (_sp, "What?");
+
+  fp = (FILE *) ap->getPtrParam ("stats_file");
+  if (!fp) {
+    fp = stdout;
+  }
+  _sp->printStats (fp, mode == 2 ? 1 : 0);
 }
 
 
@@ -694,6 +1129,18 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   RawActStackPass *_sp = (RawActStackPass *)ap->getPtrParam ("raw");
   Assert (_sp, "What?");
   
+  if (mode != 0) {
+    /* statistics modes: the stacks are already computed */
+    return _sp->getMap (p);
+  }
+
+  _sp->addProc (p);
+
+  if (_sp->skipProc (p)) {
+    /* client has up-to-date results for p; no stacks needed */
+    return NULL;
+  }
+  
   netlist_t *N = _sp->getNL (p);
   Assert (N, "What?");
 
@@ -701,6 +1148,13 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   list_t *pnodes, *nnodes;
   listitem_t *li, *mi;
   int maxedges;
+  struct stk_stats *st;
+  struct timeval t0, t1;
+  struct stk_arena *A;
+
+  st = _sp->newStats (p);
+  A = stk_arena_new ();
+  gettimeofday (&t0, NULL);
 
   /* check we have already handled this process */
 #if 0
@@ -797,7 +1251,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	    /* pairing opportunity */
 	    struct gate_pairs *p, *p2;
 
-	    NEW (p, struct gate_pairs);
+	    p = stk_pair_new (A);
 	    p->l.n = l;
 	    p->l.p = m;
 	    p->basepair = 1;
@@ -831,7 +1285,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 		 disconnection chance */
 	      p->share--;
 	      // add another gate pair, singleton
-	      NEW (p2, struct gate_pairs);
+	      p2 = stk_pair_new (A);
 	      *p2 = *p;
 	      p2->share = 1;
 	      p2->nodeshare = p2->l.endpoint (N) + p2->r.endpoint (N);
@@ -843,29 +1297,28 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	    /* nodeshare is good: left and right edges have the *same* node */
 	    p->nodeshare = p->l.endpoint (N) + p->r.endpoint (N);
 
+	    st->raw_pairs++;
+	    if (p2) {
+	      st->raw_pairs++;
+	    }
+
 	    /* see if we can find this in the heap */
-	    if (!find_pairs (pairs, p)) {
+	    if (!find_pairs (pairs, p, st)) {
 	      heap_insert (pairs, maxedges-COST(p), p);
+	      st->heap_ops++;
 	      list_append (rawpairs, p);
 #if 0
 	      dump_pair (N, p);
 #endif
 	    }
-	    else {
-	      delete_pair (p);
-	    }
-	    if (p2 && !find_pairs (pairs, p2)) {
+	    if (p2 && !find_pairs (pairs, p2, st)) {
 	      heap_insert (pairs, maxedges-COST(p2), p2);
+	      st->heap_ops++;
 	      list_append (rawpairs, p2);
 #if 0
 	      dump_pair (N, p);
 #endif
 	    }
-	    else {
-	      if (p2) {
-		delete_pair (p2);
-	      }
-	    }
 	  }
 	}
       }
@@ -884,6 +1337,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     /* for each element of the heap, attempt to extend the size using
        one of the pairs */
     gp = (struct gate_pairs *) heap_remove_min (pairs);
+    st->heap_ops++;
 #if 0
     /* XXX: need to prune the search tree */
     printf ("looking-at:\n");
@@ -919,18 +1373,18 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	if ((gtmp->l == gp->l) || (gtmp->l == gp->r) ||
 	    (gtmp->r == gp->l) || (gtmp->r == gp->r)) {
 	  /* opportunity! */
-	  NEW (gnew, struct gate_pairs);
+	  gnew = stk_pair_new (A);
 	  
 	  gnew->share = gtmp->share + gp->share;
 	  gnew->nodeshare = gtmp->nodeshare + gp->nodeshare;
 
 	  gnew->basepair = 0;
 	  if (gp->basepair) {
-	    gnew->u.gp = list_new ();
+	    gnew->u.gp = stk_list_new (A);
 	    list_append (gnew->u.gp, gp);
 	  }
 	  else {
-	    gnew->u.gp = list_dup (gp->u.gp);
+	    gnew->u.gp = stk_list_dup (A, gp->u.gp);
 	  }
 
 	  if (gtmp->l == gp->l) {
@@ -966,16 +1420,14 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	    list_append (gnew->u.gp, gtmp);
 	  }
 	  found = 1;
-	  if (!find_pairs (pairs, gnew)) {
+	  if (!find_pairs (pairs, gnew, st)) {
 	    heap_insert (pairs, maxedges - COST(gnew), gnew);
+	    st->heap_ops++;
 #if 0
 	    printf ("new-pair: ");
 	    dump_pair (N, gnew);
 #endif
 	  }
-	  else {
-	    delete_pair (gnew);
-	  }
 	}
       }
     }
@@ -997,14 +1449,9 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
       }
     }
 
-    if (!found && !find_pairs (final, gp)) {
+    if (!found && !find_pairs (final, gp, st)) {
       heap_insert (final, maxedges - COST(gp), gp);
-    }
-    else {
-      if (!gp->basepair) {
-	/* don't free raw pairs */
-	delete_pair (gp);
-      }
+      st->heap_ops++;
     }
   }
 
@@ -1014,7 +1461,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   */
   list_t *stks;
 
-  stks = list_new ();
+  stks = stk_list_new (A);
 
 #if 0
   printf ("-- candidates ---\n");
@@ -1023,6 +1470,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     struct gate_pairs *gp;
     
     gp = (struct gate_pairs *) heap_remove_min (final);
+    st->heap_ops++;
 
 #if 0
     dump_pair (N, gp);
@@ -1031,21 +1479,6 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     if (gp->available_mark ()) {
       list_append (stks, gp);
     }
-    else {
-      if (!gp->basepair) {
-	delete_pair (gp);
-      }
-    }
-  }
-
-  for (li = list_first (rawpairs); li; li = list_next (li)) {
-    struct gate_pairs *gp;
-
-    gp = (struct gate_pairs *) list_value (li);
-
-    if (!gp->visited) {
-      delete_pair (gp);
-    }
   }
   list_free (rawpairs);
   
@@ -1062,8 +1495,8 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     //printf ("-- attempt to extend --\n");
     //dump_pair (N, gp);
 
-    extend_gatepair (N, &gp, 0);
-    extend_gatepair (N, &gp, 1);
+    extend_gatepair (N, &gp, 0, A, st);
+    extend_gatepair (N, &gp, 1, A, st);
     //dump_pair (N, gp);
     list_value (li) = gp;
 
@@ -1108,23 +1541,241 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   list_free (pnodes);
   pnodes = tmplist;
 
-  list_t *stk_n = NULL, *stk_p = NULL;
+  struct stk_result *ret;
+
+  ret = (struct stk_result *) stk_arena_alloc (A, sizeof (struct stk_result));
+  ret->arena = A;
+  ret->nn = 0;
+  ret->n = NULL;
+  ret->np = 0;
+  ret->p = NULL;
+  
   if (list_length (nnodes) > 0) {
-    stk_n = compute_raw_stacks (N, nnodes, EDGE_NFET);
+    compute_raw_stacks (N, nnodes, EDGE_NFET, A, &ret->nn, &ret->n);
   }
   list_free (nnodes);
   if (list_length (pnodes) > 0) {
-    stk_p = compute_raw_stacks (N, pnodes, EDGE_PFET);
+    compute_raw_stacks (N, pnodes, EDGE_PFET, A, &ret->np, &ret->p);
   }
   list_free (pnodes);
+
+  ret->ndual = list_length (stks);
+  ret->dual = (struct stk_dual *)
+    stk_arena_alloc (A, sizeof (struct stk_dual)*ret->ndual);
+  int k = 0;
+  for (li = list_first (stks); li; li = list_next (li)) {
+    stk_flatten_dual ((struct gate_pairs *) list_value (li),
+		      &ret->dual[k++], A);
+  }
+
+  /* gate pair lists are not needed past this point */
+  stk_arena_free_lists (A);
+  
+  st->ndual = ret->ndual;
+  st->nsingle_n = ret->nn;
+  st->nsingle_p = ret->np;
+
+  gettimeofday (&t1, NULL);
+  st->wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec)*1e-6;
+
+  return ret;
+}
+
+struct stk_result *RawActStackPass::getStacks (Process *p)
+{
+  return (struct stk_result *) me->getMap (p);
+}
+
+int RawActStackPass::isEmpty (struct stk_result *stk)
+{
+  if (!stk) return 1;
+  if (stk->ndual > 0 || stk->nn > 0 || stk->np > 0) return 0;
+  return 1;
+}
+
+RawActStackPass::RawActStackPass (ActPass *p)
+{
+  me = p;
+  nl = NULL;
+  stats = list_new ();
+  procs = list_new ();
+  skip_cookie = NULL;
+  skip_fn = NULL;
+}
+
+RawActStackPass::~RawActStackPass ()
+{
+  listitem_t *li;
+  for (li = list_first (stats); li; li = list_next (li)) {
+    struct stk_stats *st = (struct stk_stats *) list_value (li);
+    FREE (st);
+  }
+  list_free (stats);
+  list_free (procs);
+}
+
+static unsigned long stk_hash_real (unsigned long h, const char *s)
+{
+  double v;
+  if (config_exists (s)) {
+    v = config_get_real (s);
+  }
+  else {
+    v = 0;
+  }
+  return fnv_hash (h, &v, sizeof (v));
+}
+
+#define NODE_ID(n) ((n) ? (long)(n)->i : -1L)
+
+unsigned long RawActStackPass::fingerprint (Process *p)
+{
+  netlist_t *N = getNL (p);
+  unsigned long h = FNV_INIT;
+  char buf[1024];
+  node_t *n;
+  listitem_t *li;
+
+  Assert (N, "What?");
+
+  h = stk_hash_real (h, "net.lambda");
+  h = stk_hash_real (h, "net.fold_nfet_width");
+  h = stk_hash_real (h, "net.fold_pfet_width");
+
+  h = fnv_hash_int (h, NODE_ID (N->Vdd));
+  h = fnv_hash_int (h, NODE_ID (N->GND));
+  h = fnv_hash_int (h, N->leak_correct);
+  h = fnv_hash_int (h, A_LEN (N->bN->ports));
+  for (int i=0; i < A_LEN (N->bN->ports); i++) {
+    h = fnv_hash_int (h, N->bN->ports[i].omit);
+    h = fnv_hash_int (h, N->bN->ports[i].input);
+  }
   
-  list_t *retlist;
-  retlist = list_new ();
-  list_append (retlist, stks);
-  list_append (retlist, stk_n);
-  list_append (retlist, stk_p);
+  for (n = N->hd; n; n = n->next) {
+    ActNetlistPass::sprint_node (buf, 1024, N, n);
+    h = fnv_hash (h, buf, strlen (buf)+1);
+    h = fnv_hash_int (h, n->i);
+    h = fnv_hash_int (h, n->supply);
+    h = fnv_hash_int (h, n->inv);
+    for (li = list_first (n->e); li; li = list_next (li)) {
+      edge_t *e = (edge_t *) list_value (li);
+      if (e->a != n) continue;	// each edge is hashed once
+      h = fnv_hash_int (h, NODE_ID (e->g));
+      h = fnv_hash_int (h, NODE_ID (e->a));
+      h = fnv_hash_int (h, NODE_ID (e->b));
+      h = fnv_hash_int (h, NODE_ID (e->bulk));
+      h = fnv_hash_int (h, e->w);
+      h = fnv_hash_int (h, e->l);
+      h = fnv_hash_int (h, e->flavor);
+      h = fnv_hash_int (h, e->type);
+      h = fnv_hash_int (h, e->nfolds);
+      h = fnv_hash_int (h, e->pchg | (e->keeper << 1) | (e->combf << 2));
+    }
+  }
+  return h;
+}
+
+struct stk_stats *RawActStackPass::newStats (Process *p)
+{
+  struct stk_stats *st;
+
+  NEW (st, struct stk_stats);
+  st->p = p;
+  st->raw_pairs = 0;
+  st->dup_pairs = 0;
+  st->heap_ops = 0;
+  st->extend_iter = 0;
+  st->ndual = 0;
+  st->nsingle_n = 0;
+  st->nsingle_p = 0;
+  st->wall = 0;
+  list_append (stats, st);
+  return st;
+}
+
+/* print s as a JSON string */
+static void print_json_string (FILE *fp, const char *s)
+{
+  fputc ('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fprintf (fp, "\\%c", *s);
+    }
+    else if ((unsigned char)*s < 0x20) {
+      fprintf (fp, "\\u%04x", (unsigned char)*s);
+    }
+    else {
+      fputc (*s, fp);
+    }
+  }
+  fputc ('"', fp);
+}
 
-  return retlist;
+void RawActStackPass::printStats (FILE *fp, int json)
+{
+  listitem_t *li;
+  struct stk_stats tot;
+  int count = 0;
+
+  tot.raw_pairs = 0;
+  tot.dup_pairs = 0;
+  tot.heap_ops = 0;
+  tot.extend_iter = 0;
+  tot.ndual = 0;
+  tot.nsingle_n = 0;
+  tot.nsingle_p = 0;
+  tot.wall = 0;
+
+  if (json) {
+    fprintf (fp, "{\n  \"processes\": [");
+  }
+  else {
+    fprintf (fp, "%-40s %8s %8s %8s %8s %5s %5s %5s %10s\n",
+	     "process", "raw", "dup", "heap", "extend", "dual", "n", "p",
+	     "time(ms)");
+  }
+  for (li = list_first (stats); li; li = list_next (li)) {
+    struct stk_stats *st = (struct stk_stats *) list_value (li);
+    if (json) {
+      fprintf (fp, "%s\n    { \"name\": ", count > 0 ? "," : "");
+      print_json_string (fp, st->p->getName());
+      fprintf (fp, ", \"raw_pairs\": %d, "
+	       "\"dup_pairs\": %d, \"heap_ops\": %d, \"extend_iter\": %d, "
+	       "\"dual\": %d, \"single_n\": %d, \"single_p\": %d, "
+	       "\"time\": %g }",
+	       st->raw_pairs, st->dup_pairs, st->heap_ops, st->extend_iter,
+	       st->ndual, st->nsingle_n, st->nsingle_p, st->wall);
+    }
+    else {
+      fprintf (fp, "%-40s %8d %8d %8d %8d %5d %5d %5d %10.3f\n",
+	       st->p->getName(), st->raw_pairs, st->dup_pairs, st->heap_ops,
+	       st->extend_iter, st->ndual, st->nsingle_n, st->nsingle_p,
+	       st->wall*1e3);
+    }
+    tot.raw_pairs += st->raw_pairs;
+    tot.dup_pairs += st->dup_pairs;
+    tot.heap_ops += st->heap_ops;
+    tot.extend_iter += st->extend_iter;
+    tot.ndual += st->ndual;
+    tot.nsingle_n += st->nsingle_n;
+    tot.nsingle_p += st->nsingle_p;
+    tot.wall += st->wall;
+    count++;
+  }
+  if (json) {
+    fprintf (fp, "\n  ],\n  \"total\": { \"processes\": %d, "
+	     "\"raw_pairs\": %d, \"dup_pairs\": %d, \"heap_ops\": %d, "
+	     "\"extend_iter\": %d, \"dual\": %d, \"single_n\": %d, "
+	     "\"single_p\": %d, \"time\": %g }\n}\n", count,
+	     tot.raw_pairs, tot.dup_pairs, tot.heap_ops, tot.extend_iter,
+	     tot.ndual, tot.nsingle_n, tot.nsingle_p, tot.wall);
+  }
+  else {
+    fprintf (fp, "%-40s %8d %8d %8d %8d %5d %5d %5d %10.3f\n",
+	     "total", tot.raw_pairs, tot.dup_pairs, tot.heap_ops,
+	     tot.extend_iter, tot.ndual, tot.nsingle_n, tot.nsingle_p,
+	     tot.wall*1e3);
+  }
 }
 
 void *stk_data (ActPass *ap, Data *d, int mode)
@@ -1140,9 +1791,10 @@ void *stk_chan (ActPass *ap, Channel *c, int mode)
 void stk_free (ActPass *ap, void *v)
 {
   if (v) {
-    list_t *stk = (list_t *)v;
-    /* XXX do something here! */
-    list_free (stk);
+    struct stk_result *stk = (struct stk_result *)v;
+
+    /* everything, including stk itself, is owned by the arena */
+    stk_arena_free (stk->arena);
   }
 }
 
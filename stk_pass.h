@@ -66,21 +66,95 @@ struct gate_pairs {
   int available_mark ();
 };
 
+/*-- stacks handed to the layout pass --*/
+
+/* one fet in a stack */
+struct stk_entry {
+  edge_t *e;			// NULL: no fet on this side of a dual stack
+  int fold;			// fold index of the edge
+  node_t *n;			// diffusion node to the right of the fet
+};
+
+/* single n or p stack: left, s[0].e, s[0].n, s[1].e, s[1].n, ... */
+struct stk_single {
+  node_t *left;			// leftmost diffusion node
+  int len;
+  struct stk_entry *s;
+};
+
+/* dual stack: n[i] and p[i] are vertically aligned */
+struct stk_dual {
+  node_t *nleft, *pleft;	// leftmost n and p diffusion nodes
+  int len;
+  struct stk_entry *n, *p;
+  unsigned int basepair:1;	// from a single gate pair
+  int nlend, plend;		// folds [0,xlend) get the LEFT edge flag
+};
+
+struct stk_arena;
+
+struct stk_result {
+  int ndual;
+  struct stk_dual *dual;
+  int nn, np;
+  struct stk_single *n, *p;	// single stacks
+  struct stk_arena *arena;	// owns all the storage above
+};
+
+/*-- per-process counters collected by stk_proc() --*/
+struct stk_stats {
+  Process *p;
+  int raw_pairs;	     // raw gate pairs generated
+  int dup_pairs;	     // candidates rejected by find_pairs()
+  int heap_ops;		     // heap inserts + removals
+  int extend_iter;	     // extend_gatepair() iterations
+  int ndual;		     // # of dual stacks
+  int nsingle_n, nsingle_p;  // # of n/p single stacks
+  double wall;		     // wall-clock time in seconds
+};
+
 class RawActStackPass {
 public:
-  RawActStackPass (ActPass *p) { me = p; }
+  RawActStackPass (ActPass *p);
+  ~RawActStackPass ();
   
-  int isEmpty (list_t *stk);
-  list_t *getStacks (Process *p = NULL);
+  int isEmpty (struct stk_result *stk);
+  struct stk_result *getStacks (Process *p = NULL);
   netlist_t *getNL (Process *p = NULL) { return nl->getNL (p); }
 
   void setNL (ActNetlistPass *_nl) { nl = _nl; }
   void *getMap (Process *p) { return me->getMap (p); }
   ActPass *getPass () { return me; }
 
+  struct stk_stats *newStats (Process *p);
+
+  /* print collected statistics: table, or JSON if json is non-zero */
+  void printStats (FILE *fp, int json);
+
+  /* hash of the netlist of p plus the config that affects stacking */
+  unsigned long fingerprint (Process *p);
+
+  /* processes for which fn returns 1 are not stacked */
+  void setSkipFn (void *cookie, int (*fn)(void *, Process *)) {
+    skip_cookie = cookie;
+    skip_fn = fn;
+  }
+  int skipProc (Process *p) {
+    return skip_fn ? (*skip_fn)(skip_cookie, p) : 0;
+  }
+
+  /* processes seen by mode 0 of the pass, in traversal order */
+  void addProc (Process *p) { list_append (procs, p); }
+  list_t *getProcs () { return procs; }
+
 private:
   ActNetlistPass *nl;
   ActPass *me;
+  list_t *stats;		// list of stk_stats, in stacking order
+  list_t *procs;		// list of Process *, in traversal order
+
+  void *skip_cookie;
+  int (*skip_fn)(void *, Process *);
 };
 
 extern "C" {
@@ -19,6 +19,9 @@
  *
  **************************************************************************
  */
+#include <string.h>
+#include <algorithm>
+#include <thread>
 #include "subcell.h"
 
 int LayerSubcell::subcell_level_threshold = 10;
@@ -26,149 +29,385 @@ int LayerSubcell::subcell_level_threshold = 10;
 // This must be always larger than subcell_level_threshold
 int LayerSubcell::subcell_recompute_threshold = 200;
 
+void SubcellInst::_computeBoxes ()
+{
+  _bbox.clear ();
+  _bloatbbox.clear ();
+  _abutbox.clear ();
+  _valid = 1;
+  if (!_b) {
+    return;
+  }
+
+  Rectangle r = _b->getBBox ();
+  Rectangle a = _b->getAbutBox ();
+  Rectangle abut = a;
+  if (a.empty()) {
+    a = r;
+  }
+
+  long fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
+  long fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
+    
+  _bbox.setRectCoords (r.llx(), r.lly(), r.llx() + a.wx()*_nx + fringex,
+		       r.lly() + a.wy()*_ny + fringey);
+
+  r = _b->getBloatBBox ();
+  fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
+  fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
+  _bloatbbox.setRectCoords (r.llx(), r.lly(),
+			    r.llx() + a.wx()*_nx + fringex,
+			    r.lly() + a.wy()*_ny + fringey);
+
+  if (abut.empty()) {
+    _abutbox = _bbox;
+  }
+  else {
+    _abutbox.setRect (abut.llx(), abut.lly(), abut.wx()*_nx, abut.wy()*_ny);
+  }
+
+  /* into the coordinates of the parent */
+  _bbox = _m.applyBox (_bbox);
+  _bloatbbox = _m.applyBox (_bloatbbox);
+  _abutbox = _m.applyBox (_abutbox);
+}
+
+/* transform of array element (ix,iy): the array offset, then the
+   instance transform, then m */
+void SubcellInst::_elemMat (int ix, int iy, TransformMat *m,
+			    TransformMat *em)
+{
+  long px, py;
+
+  _pitch (&px, &py);
+  em->mkI ();
+  em->translate (ix*px, iy*py);
+  em->applyMat (_m);
+  if (m) {
+    em->applyMat (*m);
+  }
+}
+
+/* array pitch: the abutment box if there is one, else the bbox */
+void SubcellInst::_pitch (long *px, long *py)
+{
+  Rectangle a = _b->getAbutBox ();
+  if (a.empty()) {
+    a = _b->getBBox ();
+  }
+  *px = a.wx();
+  *py = a.wy();
+}
+
+static long floor_div (long a, long b)
+{
+  long q = a / b;
+  if ((a % b != 0) && (a < 0)) {
+    q--;
+  }
+  return q;
+}
+
+static long ceil_div (long a, long b)
+{
+  return -floor_div (-a, b);
+}
+
+/*
+ * Element i covers [ll + i*p, ur + i*p] of the subcell box, so the
+ * overlapping elements are found arithmetically.
+ */
+int SubcellInst::elementRange (const Rectangle *w, int *xlo, int *xhi,
+			       int *ylo, int *yhi)
+{
+  long px, py;
+  long lo, hi;
+
+  *xlo = 0;
+  *xhi = _nx - 1;
+  *ylo = 0;
+  *yhi = _ny - 1;
+  if (!w) {
+    return 1;
+  }
+  if (!_b || !getBBox().overlaps (*w)) {
+    return 0;
+  }
+  Rectangle r = _b->getBBox ();
+  Rectangle lw = _m.inverse().applyBox (*w);
+  w = &lw;
+  _pitch (&px, &py);
+
+  if (px > 0) {
+    lo = MAX (ceil_div (w->llx() - r.urx(), px), 0);
+    hi = MIN (floor_div (w->urx() - r.llx(), px), _nx - 1);
+    if (lo > hi) {
+      return 0;
+    }
+    *xlo = lo;
+    *xhi = hi;
+  }
+  if (py > 0) {
+    lo = MAX (ceil_div (w->lly() - r.ury(), py), 0);
+    hi = MIN (floor_div (w->ury() - r.lly(), py), _ny - 1);
+    if (lo > hi) {
+      return 0;
+    }
+    *ylo = lo;
+    *yhi = hi;
+  }
+  return 1;
+}
+
+list_t *SubcellInst::_replicate (list_t *child, TransformMat *m,
+				 const Rectangle *w)
+{
+  list_t *ret = list_new ();
+  int xlo, xhi, ylo, yhi;
+  int first = 1;
+  listitem_t *li;
+
+  if (!elementRange (w, &xlo, &xhi, &ylo, &yhi) || list_isempty (child)) {
+    LayoutBlob::searchFree (child);
+    return ret;
+  }
+  
+  for (int iy = ylo; iy <= yhi; iy++) {
+    for (int ix = xlo; ix <= xhi; ix++) {
+      TransformMat em;
+      _elemMat (ix, iy, m, &em);
+      for (li = list_first (child); li; li = list_next (li)) {
+	struct tile_listentry *ce = (struct tile_listentry *) list_value (li);
+	struct tile_listentry *tle;
+	NEW (tle, struct tile_listentry);
+	tle->m = ce->m;
+	tle->m.applyMat (em);
+	tle->tiles = ce->tiles;
+	tle->shared = (first && !ce->shared) ? 0 : 1;
+	list_append (ret, tle);
+      }
+      first = 0;
+    }
+  }
+  for (li = list_first (child); li; li = list_next (li)) {
+    FREE (list_value (li));
+  }
+  list_free (child);
+  return ret;
+}
+
+list_t *SubcellInst::search (void *net, TransformMat *m, const Rectangle *w)
+{
+  if (!_b) {
+    return list_new ();
+  }
+  return _replicate (_b->search (net), m, w);
+}
+
+list_t *SubcellInst::search (int type, TransformMat *m, const Rectangle *w)
+{
+  if (!_b) {
+    return list_new ();
+  }
+  return _replicate (_b->search (type), m, w);
+}
+
+list_t *SubcellInst::searchAllMetal (TransformMat *m, const Rectangle *w)
+{
+  if (!_b) {
+    return list_new ();
+  }
+  return _replicate (_b->searchAllMetal (), m, w);
+}
+
+/* 
+ * Tiles of one array element: the element transform is applied after
+ * the transform within the subcell, as in _replicate().
+ */
+struct elem_visit {
+  void *cookie;
+  tile_visitor_t fn;
+  TransformMat em;
+};
+
+static void elem_tile (void *cookie, Layer *l, int via, Tile *t,
+		       const TransformMat *m)
+{
+  struct elem_visit *ev = (struct elem_visit *) cookie;
+  TransformMat x = *m;
+  x.applyMat (ev->em);
+  (*ev->fn) (ev->cookie, l, via, t, &x);
+}
+
+void SubcellInst::visitTiles (blob_search kind, void *net, int type,
+			      void *cookie, tile_visitor_t fn,
+			      TransformMat *m, const Rectangle *w)
+{
+  struct elem_visit ev;
+  int xlo, xhi, ylo, yhi;
+
+  if (!_b || !elementRange (w, &xlo, &xhi, &ylo, &yhi)) {
+    return;
+  }
+  ev.cookie = cookie;
+  ev.fn = fn;
+  for (int iy = ylo; iy <= yhi; iy++) {
+    for (int ix = xlo; ix <= xhi; ix++) {
+      _elemMat (ix, iy, m, &ev.em);
+      _b->visitTiles (kind, net, type, &ev, elem_tile);
+    }
+  }
+}
+
+void SubcellInst::freeze (BlobSnapshot *s, TransformMat *m)
+{
+  TransformMat em;
+
+  if (!_b) {
+    return;
+  }
+  for (int iy = 0; iy < _ny; iy++) {
+    for (int ix = 0; ix < _nx; ix++) {
+      _elemMat (ix, iy, m, &em);
+      _b->_freeze (s, &em);
+    }
+  }
+}
+
+void SubcellInst::PrintRect (FILE *fp, TransformMat *mat)
+{
+  TransformMat em;
+
+  if (!_b) {
+    return;
+  }
+  for (int iy = 0; iy < _ny; iy++) {
+    for (int ix = 0; ix < _nx; ix++) {
+      _elemMat (ix, iy, mat, &em);
+      _b->_printRect (fp, &em);
+    }
+  }
+}
+
+/*
+ * The union of the translated copies of a box is the box stretched
+ * by the array extent; only that is transformed.
+ */
+void SubcellInst::_arrayBBox (blob_search kind, void *net, int type,
+			      TransformMat *m,
+			      long *llx, long *lly, long *urx, long *ury)
+{
+  long px, py;
+
+  if (!_b) {
+    *llx = 0;
+    *lly = 0;
+    *urx = -1;
+    *ury = -1;
+    return;
+  }
+  _b->searchBBox (kind, net, type, NULL, llx, lly, urx, ury);
+  if (*llx > *urx) {
+    /* empty */
+    return;
+  }
+  _pitch (&px, &py);
+  *urx += (_nx - 1)*px;
+  *ury += (_ny - 1)*py;
+
+  TransformMat tm = _m;
+  if (m) {
+    tm.applyMat (*m);
+  }
+  (*urx)--;
+  (*ury)--;
+  tm.applyBoxes (1, llx, lly, urx, ury);
+  (*urx)++;
+  (*ury)++;
+}
+
+void SubcellInst::searchBBox (void *net, TransformMat *m,
+			      long *llx, long *lly, long *urx, long *ury)
+{
+  _arrayBBox (BLOB_SEARCH_NET, net, 0, m, llx, lly, urx, ury);
+}
+
+void SubcellInst::searchBBox (int type, TransformMat *m,
+			      long *llx, long *lly, long *urx, long *ury)
+{
+  _arrayBBox (BLOB_SEARCH_TYPE, NULL, type, m, llx, lly, urx, ury);
+}
+
+/*
+ * Bounding box of a subcell, saved while (re)building a subtree.
+ */
+struct subcell_ent {
+  SubcellInst *c;
+  Rectangle r;
+  long cx, cy;			// twice the center
+};
+
+/*
+ * Subcells at a level straddle the split, so they are spread out
+ * along the other axis; sort them that way.
+ */
+void LayerSubcell::_addLocal (SubcellInst *s, const Rectangle &r)
+{
+  _levelcount++;
+  if (!_lst) {
+    _lst = new SubcellList (_splitx == 1 ? false : true);
+  }
+  _lst->add (s, r);
+}
+
+int LayerSubcell::_delLocal (SubcellInst *s, const Rectangle &r)
+{
+  if (!_lst || !_lst->del (s, r)) {
+    return 0;
+  }
+  _levelcount--;
+  if (_levelcount == 0) {
+    delete _lst;
+    _lst = NULL;
+  }
+  return 1;
+}
+
 void LayerSubcell::addSubcell (SubcellInst *s)
 {
   const Rectangle &r = s->getBBox ();
   Assert (_region.contains (r), "What?");
-  if (_bbox.empty()) {
-    _computeBBox();
+  if (!_bbox.empty()) {
+    _bbox = _bbox ^ r;
+    _bloatbbox = _bloatbbox ^ s->getBloatBBox ();
+    _abutbox = _abutbox ^ s->getAbutBox ();
   }
-  _bbox = _bbox ^ r;
-  if (_leq || _gt) {
-    if (_leq->_splitx) {
-      if (_splitval < r.llx()) {
-	_gt->addSubcell (s);
-      }
-      else if (r.urx() <= _splitval) {
-	_leq->addSubcell (s);
-      }
-      else {
-	// add to this level
-	_levelcount++;
-	if (!_lst) {
-	  _lst = new SubcellList (s);
-	}
-	else {
-	  _lst->append (s, _splitx == 1 ? true : false);
-	}
-      }
+  _count++;
+  if (_leq) {
+    int side = _side (r);
+    if (side < 0) {
+      _leq->addSubcell (s);
     }
-    else {
-      if (_splitval < r.lly()) {
-	_gt->addSubcell (s);
-      }
-      else if (r.ury() <= _splitval) {
-	_leq->addSubcell (s);
-      }
-      else {
-	_levelcount++;
-	if (!_lst) {
-	  _lst = new SubcellList (s);
-	}
-	else {
-	  _lst->append (s, _splitx == 1 ? true : false);
-	}
-      }
+    else if (side > 0) {
+      _gt->addSubcell (s);
     }
-    if (_levelcount > subcell_level_threshold) {
-      if (!_leq && !_gt) {
-	// find an x-split, and find a y-split
-	SubcellList *tmp;
-	double x_mean, y_mean;
-	x_mean = 0;
-	y_mean = 0;
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  x_mean += (c->getBBox().llx() + c->getBBox().urx())/2;
-	  y_mean += (c->getBBox().lly() + c->getBBox().ury())/2;
-	}
-	x_mean /= _levelcount;
-	y_mean /= _levelcount;
-
-	int x_count_left, y_count_left;
-	x_count_left = 0;
-	y_count_left = 0;
-
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  if (c->getBBox().urx() <= (long)x_mean) {
-	    x_count_left++;
-	  }
-	  if (c->getBBox().ury() <= (long)y_mean) {
-	    y_count_left++;
-	  }
-	}
-#ifndef ABS
-#define ABS(a) ((a) < 0 ? -(a) : (a))
-#endif
-	unsigned int x_gap, y_gap;
-	x_gap = ABS(_levelcount/2-x_count_left);
-	y_gap = ABS(_levelcount/2-y_count_left);
-
-
-	// create left, right sub-trees
-	if (x_gap < y_gap || (x_gap == y_gap && _splitx == 0)) {
-	  _leq = new LayerSubcell (true);
-	  _gt = new LayerSubcell (true);
-	  _splitval = x_mean;
-
-	  // split in the x direction. 
-	  Rectangle r = _region;
-	  r.setXMax (_splitval);
-	  _leq->setRegion (r);
-	  r = _region;
-	  r.setXMin (_splitval+1);
-	  _gt->setRegion (r);
-	}
-	else {
-	  _splitval = y_mean;
-	  _leq = new LayerSubcell (false);
-	  _gt = new LayerSubcell (false);
-
-	  // split in the y direction
-	  Rectangle r = _region;
-	  r.setYMax (_splitval);
-	  _leq->setRegion (r);
-	  r = _region;
-	  r.setYMin (_splitval+1);
-	  _gt->setRegion (r);
-	}
-	SubcellList *newlst = NULL;
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  if (_leq->_splitx) {
-	    if (c->getBBox().urx() <= _splitval) {
-	      _leq->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	    else if (c->getBBox().llx() > _splitval) {
-	      _gt->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	  }
-	  else {
-	    if (c->getBBox().ury() <= _splitval) {
-	      _leq->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	    else if (c->getBBox().lly() > _splitval) {
-	      _gt->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	  }
-	}
-	// now delete the subcell that were moved out
-	_lst = _lst->flushClear ();
-      }
-      else if (_levelcount > subcell_recompute_threshold) {
-	// XXX: fixme: re-partition data structure
-      }
+    else {
+      // add to this level
+      _addLocal (s, r);
     }
   }
+  else {
+    _addLocal (s, r);
+  }
+
+  /* 
+     Only rebuild once the subtree has grown by half since it was
+     last built, so the cost of a rebuild is spread over the inserts
+     that caused it.
+  */
+  if (_count > _built + _built/2 && _unbalanced ()) {
+    _rebuild ();
+  }
 }
   
 
@@ -176,96 +415,460 @@ void LayerSubcell::delSubcell (SubcellInst *s)
 {
   const Rectangle &r = s->getBBox ();
   Assert (_region.contains (r), "What?");
+  _del (s, r);
+}
+
+int LayerSubcell::_del (SubcellInst *s, const Rectangle &r)
+{
+  int found;
+  if (_leq) {
+    int side = _side (r);
+    if (side < 0) {
+      found = _leq->_del (s, r);
+    }
+    else if (side > 0) {
+      found = _gt->_del (s, r);
+    }
+    else {
+      found = _delLocal (s, r);
+    }
+  }
+  else {
+    found = _delLocal (s, r);
+  }
+  if (!found) {
+    return 0;
+  }
+  _count--;
   _bbox.clear ();
-  _bloatbbox.clear();
-  if (_leq || _gt) {
-    if (_splitx) {
-      if (_splitval < r.llx()) {
-	_gt->delSubcell (s);
-      }
-      else if (r.urx() <= _splitval) {
-	_leq->delSubcell (s);
-      }
-      else {
-	_levelcount--;
-	Assert (_lst, "What?");
-	_lst->del (s);
-	if (_levelcount == 0) {
-	  delete _lst;
-	  _lst = NULL;
-	}
-      }
+  _bloatbbox.clear ();
+  _abutbox.clear ();
+
+  if (_leq && _count <= subcell_level_threshold) {
+    // small enough to be a single list again
+    _rebuild ();
+  }
+  return 1;
+}
+
+
+/*
+ * A leaf is unbalanced if its list is too long. An internal node is
+ * unbalanced if too many subcells straddle its split, or if one side
+ * holds more than three quarters of the subtree.
+ */
+int LayerSubcell::_unbalanced ()
+{
+  if (!_leq) {
+    return _levelcount > subcell_level_threshold ? 1 : 0;
+  }
+  if (_levelcount > subcell_recompute_threshold) {
+    return 1;
+  }
+  if (4*MAX(_leq->_count, _gt->_count) > 3*_count) {
+    return 1;
+  }
+  return 0;
+}
+
+void LayerSubcell::_collect (struct subcell_ent *e, int *n)
+{
+  if (_lst) {
+    for (int i=0; i < _lst->length(); i++) {
+      e[*n].c = _lst->getCell (i);
+      e[*n].r = _lst->getBBox (i);
+      (*n)++;
+    }
+  }
+  if (_leq) {
+    _leq->_collect (e, n);
+    _gt->_collect (e, n);
+  }
+}
+
+void LayerSubcell::_rebuild ()
+{
+  struct subcell_ent *e;
+  int n;
+
+  if (_count > 0) {
+    MALLOC (e, struct subcell_ent, _count);
+  }
+  else {
+    e = NULL;
+  }
+  n = 0;
+  _collect (e, &n);
+  Assert (n == _count, "What?");
+  for (int i=0; i < n; i++) {
+    e[i].cx = e[i].r.llx() + e[i].r.urx();
+    e[i].cy = e[i].r.lly() + e[i].r.ury();
+  }
+
+  if (_leq) {
+    delete _leq;
+    delete _gt;
+    _leq = NULL;
+    _gt = NULL;
+  }
+  if (_lst) {
+    delete _lst;
+    _lst = NULL;
+  }
+  _levelcount = 0;
+
+  _build (e, n);
+  if (e) {
+    FREE (e);
+  }
+}
+
+static bool ent_xless (const struct subcell_ent &a,
+		       const struct subcell_ent &b)
+{
+  return a.cx < b.cx;
+}
+
+static bool ent_yless (const struct subcell_ent &a,
+		       const struct subcell_ent &b)
+{
+  return a.cy < b.cy;
+}
+
+/*
+ * Split at the median center in x or y, whichever leaves fewer
+ * subcells straddling the split. On success, e[] is reordered as
+ * [ leq | gt | straddle ], and the split is recorded in the node.
+ */
+int LayerSubcell::_pickSplit (struct subcell_ent *e, int n,
+			      int *nleq, int *ngt)
+{
+  int best = -1;
+  int bestval = n;
+  long splitval[2];
+
+  for (int dir=0; dir < 2; dir++) {
+    int nl, ng;
+    std::nth_element (e, e + n/2, e + n, dir == 0 ? ent_xless : ent_yless);
+    splitval[dir] = (dir == 0 ? e[n/2].cx : e[n/2].cy);
+    if (splitval[dir] < 0) {
+      splitval[dir] = (splitval[dir]-1)/2;
     }
     else {
-      if (_splitval < r.lly()) {
-	_gt->addSubcell (s);
-      }
-      else if (r.ury() <= _splitval) {
-	_leq->addSubcell (s);
+      splitval[dir] = splitval[dir]/2;
+    }
+    nl = 0;
+    ng = 0;
+    for (int i=0; i < n; i++) {
+      if (dir == 0) {
+	if (e[i].r.urx() <= splitval[dir]) nl++;
+	else if (e[i].r.llx() > splitval[dir]) ng++;
       }
       else {
-	_levelcount--;
-	Assert (_lst, "What?");
-	_lst->del (s);
-	if (_levelcount == 0) {
-	  delete _lst;
-	  _lst = NULL;
-	}
+	if (e[i].r.ury() <= splitval[dir]) nl++;
+	else if (e[i].r.lly() > splitval[dir]) ng++;
       }
     }
+    if (nl == 0 || ng == 0) {
+      continue;
+    }
+    if (n - nl - ng < bestval) {
+      best = dir;
+      bestval = n - nl - ng;
+    }
+  }
+  if (best == -1) {
+    return 0;
   }
+  _splitx = (best == 0) ? 1 : 0;
+  _splitval = splitval[best];
+
+  /* partition: [ leq | gt | straddle ] */
+  int lo = 0;
+  for (int i=0; i < n; i++) {
+    if (_side (e[i].r) < 0) {
+      struct subcell_ent tmp = e[lo];
+      e[lo] = e[i];
+      e[i] = tmp;
+      lo++;
+    }
+  }
+  *nleq = lo;
+  for (int i=lo; i < n; i++) {
+    if (_side (e[i].r) > 0) {
+      struct subcell_ent tmp = e[lo];
+      e[lo] = e[i];
+      e[i] = tmp;
+      lo++;
+    }
+  }
+  *ngt = lo - *nleq;
+  return 1;
 }
 
+void LayerSubcell::build (SubcellInst **cells, int n, int threads)
+{
+  struct subcell_ent *e;
 
-SubcellList *SubcellList::flushClear ()
+  if (_leq || _gt || _lst) {
+    fatal_error ("LayerSubcell::build() called after subcells were added!");
+  }
+  if (n == 0) {
+    return;
+  }
+  MALLOC (e, struct subcell_ent, n);
+  for (int i=0; i < n; i++) {
+    e[i].c = cells[i];
+    e[i].r = cells[i]->getBBox ();
+    e[i].cx = e[i].r.llx() + e[i].r.urx();
+    e[i].cy = e[i].r.lly() + e[i].r.ury();
+    Assert (_region.contains (e[i].r), "What?");
+  }
+  _build (e, n, threads);
+  FREE (e);
+}
+
+/* don't start a thread for less than this many subcells */
+#define SUBCELL_PAR_MIN 4096
+
+/*
+ * Build an empty node from n subcells.
+ */
+void LayerSubcell::_build (struct subcell_ent *e, int n, int threads)
 {
-  SubcellList *tmp, *prev, *cur;
-  prev = NULL;
-  cur = this;
-  while (cur) {
-    if (!cur->_cell) {
-      if (prev) {
-	prev->_next = cur->_next;
-	tmp = cur;
-	cur = cur->_next;
-	delete tmp;
-      }
-      else {
-	if (cur->_next) {
-	  tmp = cur->_next;
-	  cur->_cell = tmp->_cell;
-	  cur->_next = tmp->_next;
-	  delete tmp;
-	  cur = cur->_next;
-	}
-	else {
-	  delete this;
-	  return NULL;
-	}
-      }
+  int nl, ng;
+
+  _count = n;
+  _built = n;
+
+  if (n <= subcell_level_threshold || !_pickSplit (e, n, &nl, &ng)) {
+    for (int i=0; i < n; i++) {
+      _addLocal (e[i].c, e[i].r);
     }
-    else {
-      prev = cur;
-      cur = cur->_next;
+    return;
+  }
+
+  Rectangle r;
+  _leq = new LayerSubcell (_splitx ? true : false);
+  _gt = new LayerSubcell (_splitx ? true : false);
+  r = _region;
+  if (_splitx) {
+    r.setXMax (_splitval);
+    _leq->setRegion (r);
+    r = _region;
+    r.setXMin (_splitval+1);
+    _gt->setRegion (r);
+  }
+  else {
+    r.setYMax (_splitval);
+    _leq->setRegion (r);
+    r = _region;
+    r.setYMin (_splitval+1);
+    _gt->setRegion (r);
+  }
+  if (threads > 1 && nl >= SUBCELL_PAR_MIN && ng >= SUBCELL_PAR_MIN) {
+    /* subtrees are disjoint, and the boxes were cached up front */
+    std::thread t (&LayerSubcell::_build, _leq, e, nl, threads/2);
+    _gt->_build (e + nl, ng, threads - threads/2);
+    t.join ();
+  }
+  else {
+    _leq->_build (e, nl, threads);
+    _gt->_build (e + nl, ng, threads);
+  }
+  for (int i=nl+ng; i < n; i++) {
+    _addLocal (e[i].c, e[i].r);
+  }
+}
+
+
+void LayerSubcell::query (const Rectangle &r, void *cookie,
+			  void (*f)(void *, SubcellInst *))
+{
+  if (_count == 0 || !getBBox().overlaps (r)) {
+    return;
+  }
+  if (_lst) {
+    _lst->query (r, cookie, f);
+  }
+  if (_leq) {
+    int side = _side (r);
+    if (side <= 0) {
+      _leq->query (r, cookie, f);
+    }
+    if (side >= 0) {
+      _gt->query (r, cookie, f);
     }
   }
-  if (!prev) {
+}
+
+SubcellInst *LayerSubcell::findPoint (long x, long y, int *ix, int *iy)
+{
+  SubcellInst *c = _findPoint (x, y);
+  if (c && ix && iy) {
+    c->arrayIndex (x, y, ix, iy);
+  }
+  return c;
+}
+
+SubcellInst *LayerSubcell::_findPoint (long x, long y)
+{
+  if (_count == 0 || !getBBox().inRect (x, y)) {
     return NULL;
   }
-  return this;
+  if (_lst) {
+    SubcellInst *c = _lst->findPoint (x, y);
+    if (c) {
+      return c;
+    }
+  }
+  if (_leq) {
+    long v = _splitx ? x : y;
+    if (v <= _splitval) {
+      return _leq->_findPoint (x, y);
+    }
+    else {
+      return _gt->_findPoint (x, y);
+    }
+  }
+  return NULL;
+}
+
+SubcellInst *LayerSubcell::findNearest (long x, long y, long *dist)
+{
+  SubcellInst *best = NULL;
+  long bestd = MAX_VALUE;
+
+  _findNearest (x, y, &best, &bestd);
+  if (dist) {
+    *dist = bestd;
+  }
+  return best;
+}
+
+void LayerSubcell::_findNearest (long x, long y,
+				 SubcellInst **best, long *bestd)
+{
+  if (_count == 0 || getBBox().distance (x, y) >= *bestd) {
+    return;
+  }
+  for (int i=0; _lst && i < _lst->length(); i++) {
+    long d = _lst->getBBox(i).distance (x, y);
+    if (d < *bestd) {
+      *bestd = d;
+      *best = _lst->getCell (i);
+    }
+  }
+  if (_leq) {
+    /* the side containing the point first, for better pruning */
+    long v = _splitx ? x : y;
+    if (v <= _splitval) {
+      _leq->_findNearest (x, y, best, bestd);
+      _gt->_findNearest (x, y, best, bestd);
+    }
+    else {
+      _gt->_findNearest (x, y, best, bestd);
+      _leq->_findNearest (x, y, best, bestd);
+    }
+  }
+}
+
+
+int SubcellList::_lowerBound (long v, SubcellInst *c) const
+{
+  int lo = 0, hi = A_LEN (_l);
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    long x = _lo (_l[mid].r);
+    if (x < v || (x == v && _l[mid].c < c)) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void SubcellList::add (SubcellInst *c, const Rectangle &r)
+{
+  int pos = _lowerBound (_lo (r), c);
+  unsigned long w = _sort_x ? r.wx() : r.wy();
+
+  A_NEW (_l, struct subcell_elem);
+  if (pos < A_LEN (_l)) {
+    memmove (&_l[pos+1], &_l[pos],
+	     sizeof (struct subcell_elem)*(A_LEN (_l) - pos));
+  }
+  _l[pos].r = r;
+  _l[pos].c = c;
+  A_INC (_l);
+  if (w > _maxw) {
+    _maxw = w;
+  }
+}
+
+int SubcellList::del (SubcellInst *c, const Rectangle &r)
+{
+  int pos = _lowerBound (_lo (r), c);
+  if (pos == A_LEN (_l) || _l[pos].c != c) {
+    return 0;
+  }
+  A_LEN (_l)--;
+  if (pos < A_LEN (_l)) {
+    memmove (&_l[pos], &_l[pos+1],
+	     sizeof (struct subcell_elem)*(A_LEN (_l) - pos));
+  }
+  return 1;
+}
+
+/*
+ * Only subcells with a lower coordinate in [lo - _maxw, hi] can
+ * overlap the interval [lo, hi] on the sort axis.
+ */
+void SubcellList::query (const Rectangle &r, void *cookie,
+			 void (*f)(void *, SubcellInst *))
+{
+  long lo = _sort_x ? r.llx() : r.lly();
+  long hi = _sort_x ? r.urx() : r.ury();
+  int i;
+
+  for (i = _lowerBound (lo - (long)_maxw); i < A_LEN (_l); i++) {
+    if (_lo (_l[i].r) > hi) {
+      break;
+    }
+    if (_l[i].r.overlaps (r)) {
+      (*f) (cookie, _l[i].c);
+    }
+  }
+}
+
+SubcellInst *SubcellList::findPoint (long x, long y)
+{
+  long v = _sort_x ? x : y;
+  int i;
+
+  for (i = _lowerBound (v - (long)_maxw); i < A_LEN (_l); i++) {
+    if (_lo (_l[i].r) > v) {
+      break;
+    }
+    if (_l[i].r.inRect (x, y)) {
+      return _l[i].c;
+    }
+  }
+  return NULL;
 }
 
 
 void LayerSubcell::_computeBBox ()
 {
-  SubcellList *l;
   _bbox.clear ();
   _bloatbbox.clear ();
   _abutbox.clear ();
-  for (l = _lst; l; l = _lst->getNext()) {
-    _bbox = _bbox ^ l->getCell()->getBBox ();
-    _bloatbbox = _bloatbbox ^ l->getCell()->getBloatBBox();
-    _abutbox = _abutbox ^ l->getCell()->getAbutBox ();
+  for (int i=0; _lst && i < _lst->length(); i++) {
+    _bbox = _bbox ^ _lst->getBBox (i);
+    _bloatbbox = _bloatbbox ^ _lst->getCell(i)->getBloatBBox();
+    _abutbox = _abutbox ^ _lst->getCell(i)->getAbutBox ();
   }
   if (_leq) {
     _bbox = _bbox ^ _leq->getBBox();
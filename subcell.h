@@ -32,6 +32,16 @@ private:
   const char *_uid;		//< unique identifier for the subcell
   int _nx, _ny;			//< array size
 
+  unsigned int _valid:1;	//< 1 if the cached boxes are valid
+  Rectangle _bbox, _bloatbbox, _abutbox; //< cached boxes, with _m applied
+
+  void _computeBoxes ();
+  void _pitch (long *px, long *py);
+  void _elemMat (int ix, int iy, TransformMat *m, TransformMat *em);
+  list_t *_replicate (list_t *child, TransformMat *m, const Rectangle *w);
+  void _arrayBBox (blob_search kind, void *net, int type, TransformMat *m,
+		   long *llx, long *lly, long *urx, long *ury);
+
 public:
   SubcellInst (LayoutBlob *b, const char *id, TransformMat *m = NULL) {
     _nx = 1;
@@ -41,11 +51,30 @@ public:
     if (m) {
       _m = *m;
     }
+    _valid = 0;
   }
 
+  /*
+    The boxes are cached. Call invalidate() if the subcell layout
+    changes; remove the instance from any LayerSubcell first, since
+    that is keyed by the old bounding box.
+  */
+  void invalidate () { _valid = 0; }
+
   void mkArray (int nx, int ny) {
     _nx = nx;
     _ny = ny;
+    invalidate ();
+  }
+
+  void setTransform (TransformMat *m) {
+    if (m) {
+      _m = *m;
+    }
+    else {
+      _m.mkI ();
+    }
+    invalidate ();
   }
 
   LayoutEdgeAttrib *getLayoutEdgeAttrib () {
@@ -60,168 +89,134 @@ public:
   }
 
   Rectangle getBBox() {
-    Rectangle r;
-    if (!_b) {
-      return r;
+    if (!_valid) {
+      _computeBoxes ();
     }
-    r = _b->getBBox ();
-    Rectangle a = _b->getAbutBox ();
-    if (a.empty()) {
-      a = r;
+    return _bbox;
+  }
+
+  Rectangle getBloatBBox() {
+    if (!_valid) {
+      _computeBoxes ();
     }
+    return _bloatbbox;
+  }
 
-    long fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
-    long fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
-    
-    r.setRectCoords (r.llx(), r.lly(), r.llx() + a.wx()*_nx + fringex,
-		     r.lly() + a.wy()*_ny + fringey);
-    
-    return r;
+  Rectangle getAbutBox () {
+    if (!_valid) {
+      _computeBoxes ();
+    }
+    return _abutbox;
   }
 
-  Rectangle getBloatBBox() {
-    Rectangle r;
-    if (!_b) {
-      return r;
+  /* array element that (x,y) falls in, in getBBox() coordinates */
+  void arrayIndex (long x, long y, int *ix, int *iy) {
+    *ix = 0;
+    *iy = 0;
+    if (!_b || (_nx == 1 && _ny == 1)) {
+      return;
     }
-    r = _b->getBBox ();
+    _m.inverse().apply (x, y, &x, &y);
+    Rectangle r = _b->getBBox ();
     Rectangle a = _b->getAbutBox ();
     if (a.empty()) {
       a = r;
     }
-    r = _b->getBloatBBox ();
-
-    long fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
-    long fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
-    
-    r.setRectCoords (r.llx(), r.lly(), r.llx() + a.wx()*_nx + fringex,
-		     r.lly() + a.wy()*_ny + fringey);
-
-    return r;
-  }
-
-  Rectangle getAbutBox () {
-    Rectangle r;
-    if (!_b) {
-      return r;
+    if (a.wx() > 0 && x > a.llx()) {
+      *ix = MIN ((x - a.llx())/(long)a.wx(), _nx-1);
     }
-    r = _b->getAbutBox ();
-    if (r.empty()) {
-      return getBBox();
+    if (a.wy() > 0 && y > a.lly()) {
+      *iy = MIN ((y - a.lly())/(long)a.wy(), _ny-1);
     }
-    r.setRect (r.llx(), r.lly(), r.wx()*_nx, r.wy()*_ny);
-    return r;
   }
 
-  void PrintRect (FILE *fp, TransformMat *mat) {
-    TransformMat m;
-    if (mat) {
-      m = *mat;
-    }
-    _b->_printRect (fp, mat);
-  }
+  /*
+    Array elements [xlo..xhi] x [ylo..yhi] overlap w (in getBBox()
+    coordinates); all of them if w is NULL. Returns 0 if none do.
+  */
+  int elementRange (const Rectangle *w, int *xlo, int *xhi,
+		    int *ylo, int *yhi);
+
+  /*
+    Tile search on all array elements (or those overlapping w). The
+    subcell is searched once; each element gets a tile_listentry
+    with its own transform, sharing the tile lists.
+  */
+  list_t *search (void *net, TransformMat *m = NULL,
+		  const Rectangle *w = NULL);
+  list_t *search (int type, TransformMat *m = NULL,
+		  const Rectangle *w = NULL);
+  list_t *searchAllMetal (TransformMat *m = NULL,
+			  const Rectangle *w = NULL);
+
+  /* visitor version of search() */
+  void visitTiles (blob_search kind, void *net, int type,
+		   void *cookie, tile_visitor_t fn, TransformMat *m = NULL,
+		   const Rectangle *w = NULL);
+
+  /* bounding box of search results over the whole array, computed
+     from one search of the subcell */
+  void searchBBox (void *net, TransformMat *m,
+		   long *llx, long *lly, long *urx, long *ury);
+  void searchBBox (int type, TransformMat *m,
+		   long *llx, long *lly, long *urx, long *ury);
+
+  /* print all array elements; same order as freeze() */
+  void PrintRect (FILE *fp, TransformMat *mat);
+
+  /* add all array elements to a blob snapshot */
+  void freeze (BlobSnapshot *s, TransformMat *m);
+};
+
+/*
+ * Subcells at one level of a LayerSubcell, with their bounding boxes,
+ * kept in an array sorted by the lower coordinate along one axis.
+ */
+struct subcell_elem {
+  Rectangle r;
+  SubcellInst *c;
 };
 
 class SubcellList {
  private:
-  SubcellList *_next;		/* linked-list of subcells */
-  SubcellInst *_cell;		/* actual subcell */
+  A_DECL (struct subcell_elem, _l);
+  unsigned int _sort_x:1;	/* 1 if sorted by llx, 0 by lly */
+  unsigned long _maxw;		/* largest extent along the sort axis */
+
+  long _lo (const Rectangle &r) const {
+    return _sort_x ? r.llx() : r.lly();
+  }
+  /* first element at or after (v, c); ties are ordered by pointer */
+  int _lowerBound (long v, SubcellInst *c = NULL) const;
+
  public:
-  
-  SubcellList (SubcellInst *c) {
-    _cell = c;
-    _next = NULL;
+  SubcellList (bool sort_x) {
+    A_INIT (_l);
+    _sort_x = sort_x ? 1 : 0;
+    _maxw = 0;
   }
-  
+
   ~SubcellList () {
-    if (_next) {
-      delete _next;
-    }
+    A_FREE (_l);
   }
 
-  void append (SubcellInst *c, bool sort_x) {
-    SubcellList *tmp = new SubcellList (c);
-    SubcellList *prev,  *cur;
-    
-    prev = NULL;
-    cur = this;
-    while (cur) {
-      bool gonext;
-      if (sort_x) {
-	if (cur->_cell->getBBox().urx() < c->getBBox().llx()) {
-	  gonext = true;
-	}
-	else {
-	  gonext = false;
-	}
-      }
-      else {
-	if (cur->_cell->getBBox().ury() < c->getBBox().lly()) {
-	  gonext = true;
-	}
-	else {
-	  gonext = false;
-	}
-      }
-      if (gonext) {
-	prev = cur;
-	cur = cur->_next;
-      }
-      else {
-	if (!prev) {
-	  SubcellInst *x;
-	  tmp->_next = _next;
-	  _next = tmp;
-	  tmp->_cell = _cell;
-	  _cell = c;
-	  return;
-	}
-	else {
-	  prev->_next = tmp;
-	  tmp->_next = cur;
-	  return;
-	}
-      }
-    }
-    prev->_next = tmp;
-  }
+  void add (SubcellInst *c, const Rectangle &r);
+  int del (SubcellInst *c, const Rectangle &r); // 1 if found
 
-  SubcellList *del (SubcellInst *c) {
-    SubcellList *prev, *cur;
-    
-    prev = NULL;
-    cur = this;
-    while (cur) {
-      if (cur->_cell == c) {
-	break;
-      }
-      else {
-	prev = cur;
-	cur = cur->_next;
-      }
-    }
-    if (cur) {
-      if (prev) {
-	prev->_next = cur->_next;
-	delete cur;
-	return this;
-      }
-      else {
-	cur = cur->_next;
-	delete this;
-	return cur;
-      }
-    }
-    return this;
-  }
+  int length () const { return A_LEN (_l); }
+  SubcellInst *getCell (int i) const { return _l[i].c; }
+  const Rectangle &getBBox (int i) const { return _l[i].r; }
+
+  /* call f on every subcell whose bounding box overlaps r */
+  void query (const Rectangle &r, void *cookie,
+	      void (*f)(void *, SubcellInst *));
 
-  SubcellList *getNext() { return _next; }
-  SubcellInst *getCell() { return _cell; }
-  void clearCell() { _cell = NULL; }
-  SubcellList *flushClear();
+  SubcellInst *findPoint (long x, long y);
 };
 
 
+struct subcell_ent;
+
 /*
  * Recursively partition space
  */
@@ -238,10 +233,39 @@ class LayerSubcell {
   LayerSubcell *_leq, *_gt; /* split tile */
   SubcellList *_lst;	    /* list of subcells here */
   int _levelcount;	    /* list length */
+  int _count;		    /* # of subcells in this subtree */
+  int _built;		    /* _count when the subtree was last built */
 
 
   void _computeBBox();
 
+  /* -1 : r belongs to _leq, 1 : r belongs to _gt, 0 : straddles */
+  int _side (const Rectangle &r) {
+    if (_splitx) {
+      if (r.urx() <= _splitval) return -1;
+      if (r.llx() > _splitval) return 1;
+    }
+    else {
+      if (r.ury() <= _splitval) return -1;
+      if (r.lly() > _splitval) return 1;
+    }
+    return 0;
+  }
+
+  void _addLocal (SubcellInst *s, const Rectangle &r);
+  int _delLocal (SubcellInst *s, const Rectangle &r);
+  int _del (SubcellInst *s, const Rectangle &r);
+
+  /* rebuild the subtree with median splits */
+  int _unbalanced ();
+  void _rebuild ();
+  void _collect (struct subcell_ent *e, int *n);
+  void _build (struct subcell_ent *e, int n, int threads = 1);
+  int _pickSplit (struct subcell_ent *e, int n, int *nleq, int *ngt);
+
+  SubcellInst *_findPoint (long x, long y);
+  void _findNearest (long x, long y, SubcellInst **best, long *bestd);
+
  public:
 
   static int subcell_level_threshold; // if you exceed this threshold,
@@ -250,6 +274,8 @@ class LayerSubcell {
   static int subcell_recompute_threshold; // if you exceed this
 					  // threshold, then
 					  // re-compute the entire subtree!
+
+  int numSubcells () { return _count; }
   
   LayerSubcell(bool sort_x = true) {
     Assert (subcell_recompute_threshold  > subcell_level_threshold, "What?");
@@ -259,6 +285,8 @@ class LayerSubcell {
     _gt = NULL;
     _lst = NULL;
     _levelcount = 0;
+    _count = 0;
+    _built = 0;
   }
 
   ~LayerSubcell() {
@@ -277,7 +305,9 @@ class LayerSubcell {
     if (_leq || _gt || _lst) {
       fatal_error ("LayerSubcell:: initGlobal() called after subcells were added!");
     }
-    _region.setRect (MIN_VALUE, MIN_VALUE, MAX_VALUE, MAX_VALUE);
+    _region.setRect (MIN_VALUE, MIN_VALUE,
+		     (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		     (unsigned long)MAX_VALUE - (MIN_VALUE + 1));
   }
 
   void setRegion (Rectangle &r) {
@@ -287,6 +317,22 @@ class LayerSubcell {
   void addSubcell (SubcellInst *s);
   void delSubcell (SubcellInst *s);
 
+  /* build an empty tree from n subcells at once; the top levels are
+     built by up to "threads" threads */
+  void build (SubcellInst **cells, int n, int threads = 1);
+
+  /* call f on every subcell whose bounding box overlaps r */
+  void query (const Rectangle &r, void *cookie,
+	      void (*f)(void *, SubcellInst *));
+
+  /* a subcell whose bounding box contains (x,y), or NULL; ix/iy
+     return the array element */
+  SubcellInst *findPoint (long x, long y, int *ix = NULL, int *iy = NULL);
+
+  /* subcell with the bounding box closest to (x,y) (manhattan
+     distance), or NULL if there are none */
+  SubcellInst *findNearest (long x, long y, long *dist = NULL);
+
   Rectangle getBBox ();
   Rectangle getBloatBBox ();
   Rectangle getAbutBox();
@@ -0,0 +1,146 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+/*
+ * Checks GridSnap against the snap_up/snap_dn routines the layout
+ * pass used before, for power-of-two and other pitches, over
+ * negative, zero, on-grid and off-grid coordinates.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../grid.h"
+
+/* the original ActStackLayout snapping code */
+static long snap_up (long w, unsigned long pitch)
+{
+  if (w >= 0) {
+    if (w % pitch != 0) {
+      w += pitch - (w % pitch);
+    }
+  }
+  else {
+    w = -w;
+    if (w % pitch != 0) {
+      w += pitch - (w % pitch);
+      w = w - pitch;
+    }
+    w = -w;
+  }
+  return w;
+}
+
+static long snap_dn (long w, unsigned long pitch)
+{
+  if (w >= 0) {
+    if (w % pitch != 0) {
+      w -= (w % pitch);
+    }
+  }
+  else {
+    w = -w;
+    if (w % pitch != 0) {
+      w -= (w % pitch);
+      w = w + pitch;
+    }
+    w = -w;
+  }
+  return w;
+}
+
+static int errors = 0;
+
+static void check (const GridSnap &g, long w)
+{
+  unsigned long p = g.getPitch ();
+  long a[2];
+
+  if (g.up (w) != snap_up (w, p) || g.dn (w) != snap_dn (w, p)) {
+    if (errors < 10) {
+      printf ("pitch %lu, %ld: up %ld (expected %ld), dn %ld (expected %ld)\n",
+	      p, w, g.up (w), snap_up (w, p), g.dn (w), snap_dn (w, p));
+    }
+    errors++;
+  }
+  a[0] = w;
+  a[1] = -w;
+  g.up (a, 2);
+  if (a[0] != snap_up (w, p) || a[1] != snap_up (-w, p)) {
+    if (errors < 10) {
+      printf ("pitch %lu, %ld: batch up mismatch\n", p, w);
+    }
+    errors++;
+  }
+  a[0] = w;
+  a[1] = -w;
+  g.dn (a, 2);
+  if (a[0] != snap_dn (w, p) || a[1] != snap_dn (-w, p)) {
+    if (errors < 10) {
+      printf ("pitch %lu, %ld: batch dn mismatch\n", p, w);
+    }
+    errors++;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  unsigned long pitches[] = { 1, 2, 3, 4, 5, 7, 8, 10, 13, 64, 100, 127,
+			      140, 1000, 12345, 65536, 1000003,
+			      4294967291UL, 4294967296UL, 5000000000UL };
+  int np = sizeof (pitches)/sizeof (pitches[0]);
+
+  srand (1);
+  for (int k=0; k < np; k++) {
+    GridSnap g (pitches[k]);
+    long p = pitches[k];
+
+    /* dense range around zero */
+    for (long w = -100000; w <= 100000; w++) {
+      check (g, w);
+    }
+
+    /* on-grid values and their neighbours, both signs, including
+       the edge of the 32-bit fast path */
+    for (long m = 0; m < 1000; m++) {
+      for (long d = -1; d <= 1; d++) {
+	check (g, m*p + d);
+	check (g, -m*p + d);
+      }
+    }
+    for (long w = 0xffffffffL - 2*p; w <= 0xffffffffL + 2*p; w += (p > 16 ? p/8 : 1)) {
+      check (g, w);
+      check (g, -w);
+    }
+
+    /* random values of all magnitudes */
+    for (int t=0; t < 1000000; t++) {
+      long w = ((long)rand() << 33) ^ ((long)rand() << 2) ^ rand();
+      w >>= (t % 40);
+      check (g, (t & 1) ? -w : w);
+    }
+  }
+
+  if (errors) {
+    printf ("** %d errors\n", errors);
+    return 1;
+  }
+  printf ("ok\n");
+  return 0;
+}
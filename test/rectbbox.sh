@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Check that actrectbbox computes the same bounding box for every
+# .rect file in runs/ whether it scans the file (ReadRectBBox) or
+# builds the full layout (ReadRect + getBloatBBox).
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../actrectbbox.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actrectbbox
+  echo "testing installation"
+  echo
+else
+  ACTTOOL=../actrectbbox.$EXT
+fi
+
+if [ ! -d runs/gen ]
+then
+	mkdir -p runs/gen
+fi
+
+$ACTTOOL -cnf=m.conf -r cells.act runs > runs/gen/bbox.scan
+$ACTTOOL -cnf=m.conf -r -F cells.act runs > runs/gen/bbox.full
+
+if [ ! -s runs/gen/bbox.scan ] || ! cmp runs/gen/bbox.scan runs/gen/bbox.full >/dev/null 2>/dev/null
+then
+	echo "** FAILED: .rect bounding boxes differ"
+	diff runs/gen/bbox.scan runs/gen/bbox.full
+	exit 1
+fi
+echo "rectbbox: `wc -l < runs/gen/bbox.scan` files ok"
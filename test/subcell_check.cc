@@ -0,0 +1,471 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+/*
+ * Checks LayerSubcell against a brute-force scan of all the subcells:
+ * bulk build, incremental insert/delete (with the rebuilds they
+ * trigger), query, findPoint and findNearest. Also reports the time
+ * taken by build() vs. inserting the subcells one at a time.
+ *
+ * Arrayed instances are checked against every array element expanded
+ * by hand: the bounding box, elementRange(), the tiles search() and
+ * visitTiles() return for a window, and searchBBox().
+ *
+ * Usage: subcell_check [-n <cells>] [-j <threads>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <act/act.h>
+#include "../subcell.h"
+
+#define NSHAPES 16
+
+static int errors = 0;
+static char shape_net;		// the net of all the shapes
+
+static double now ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static long rnd (long n)
+{
+  return ((long)rand() * RAND_MAX + rand()) % n;
+}
+
+/* membership flags for query callbacks */
+struct qstate {
+  PHashtable *idx;		// subcell -> index
+  char *seen;
+};
+
+static void query_cb (void *cookie, SubcellInst *c)
+{
+  struct qstate *q = (struct qstate *) cookie;
+  phash_bucket_t *b = phash_lookup (q->idx, c);
+  long i;
+
+  if (!b) {
+    printf ("query: unknown subcell reported\n");
+    errors++;
+    return;
+  }
+  i = (long) b->v;
+  if (q->seen[i]) {
+    printf ("query: subcell %ld reported twice\n", i);
+    errors++;
+  }
+  q->seen[i] = 1;
+}
+
+/*
+ * Compare the tree against the subcells with live[i] set
+ */
+static void check_tree (const char *msg, LayerSubcell *t,
+			int n, SubcellInst **cells, char *live, int nq)
+{
+  struct qstate q;
+  int count = 0;
+
+  for (int i=0; i < n; i++) {
+    count += live[i];
+  }
+  if (t->numSubcells() != count) {
+    printf ("%s: %d subcells, expected %d\n", msg, t->numSubcells(), count);
+    errors++;
+  }
+
+  q.idx = phash_new (8);
+  for (int i=0; i < n; i++) {
+    phash_bucket_t *b = phash_add (q.idx, cells[i]);
+    b->v = (void *) (long) i;
+  }
+  MALLOC (q.seen, char, n);
+
+  for (int k=0; k < nq; k++) {
+    Rectangle w;
+    long x, y, d;
+    SubcellInst *c;
+
+    /* query */
+    w.setRect (rnd (200000) - 100000, rnd (200000) - 100000,
+	       1 + rnd (5000), 1 + rnd (5000));
+    for (int i=0; i < n; i++) {
+      q.seen[i] = 0;
+    }
+    t->query (w, &q, query_cb);
+    for (int i=0; i < n; i++) {
+      int exp = live[i] && cells[i]->getBBox().overlaps (w);
+      if (exp != q.seen[i]) {
+	printf ("%s: query mismatch on subcell %d\n", msg, i);
+	errors++;
+	break;
+      }
+    }
+
+    /* findPoint */
+    x = rnd (200000) - 100000;
+    y = rnd (200000) - 100000;
+    c = t->findPoint (x, y);
+    if (c) {
+      if (!c->getBBox().inRect (x, y)) {
+	printf ("%s: findPoint (%ld,%ld) returned a subcell outside\n",
+		msg, x, y);
+	errors++;
+      }
+    }
+    else {
+      for (int i=0; i < n; i++) {
+	if (live[i] && cells[i]->getBBox().inRect (x, y)) {
+	  printf ("%s: findPoint (%ld,%ld) missed subcell %d\n", msg, x, y, i);
+	  errors++;
+	  break;
+	}
+      }
+    }
+
+    /* findNearest */
+    long bestd = -1;
+    for (int i=0; i < n; i++) {
+      if (live[i]) {
+	long dd = cells[i]->getBBox().distance (x, y);
+	if (bestd < 0 || dd < bestd) {
+	  bestd = dd;
+	}
+      }
+    }
+    c = t->findNearest (x, y, &d);
+    if (bestd < 0) {
+      if (c) {
+	printf ("%s: findNearest found a subcell in an empty tree\n", msg);
+	errors++;
+      }
+    }
+    else if (!c || d != bestd || c->getBBox().distance (x, y) != bestd) {
+      printf ("%s: findNearest (%ld,%ld): got %ld, expected %ld\n",
+	      msg, x, y, c ? d : -1, bestd);
+      errors++;
+    }
+  }
+  FREE (q.seen);
+  phash_free (q.idx);
+}
+
+/* bounding box of array element (ix,iy) of b under m, by hand */
+static Rectangle elem_box (LayoutBlob *b, TransformMat *m, int ix, int iy)
+{
+  Rectangle r = b->getBBox ();
+  Rectangle a = b->getAbutBox ();
+  Rectangle e;
+
+  if (a.empty()) {
+    a = r;
+  }
+  e.setRect (r.llx() + ix*(long)a.wx(), r.lly() + iy*(long)a.wy(),
+	     r.wx(), r.wy());
+  return m->applyBox (e);
+}
+
+/* tiles found in a window, matched against the element boxes */
+struct hits {
+  int n;
+  Rectangle *box;		// element boxes
+  char *seen;
+};
+
+static void hit_tile (struct hits *h, Tile *t, const TransformMat *m)
+{
+  long llx, lly, urx, ury;
+  Rectangle r;
+  int i;
+
+  llx = t->getllx();
+  lly = t->getlly();
+  urx = t->geturx();
+  ury = t->getury();
+  m->applyBoxes (1, &llx, &lly, &urx, &ury);
+  r.setRect (llx, lly, urx - llx + 1, ury - lly + 1);
+  for (i=0; i < h->n; i++) {
+    if (h->box[i].contains (r)) {
+      break;
+    }
+  }
+  if (i == h->n) {
+    printf ("array: tile outside all the elements\n");
+    errors++;
+    return;
+  }
+  h->seen[i] = 1;
+}
+
+static void visit_cb (void *cookie, Layer *l, int via, Tile *t,
+		      const TransformMat *m)
+{
+  hit_tile ((struct hits *) cookie, t, m);
+}
+
+static void search_hits (struct hits *h, list_t *tiles)
+{
+  for (listitem_t *li = list_first (tiles); li; li = list_next (li)) {
+    struct tile_listentry *tle = (struct tile_listentry *) list_value (li);
+    for (listitem_t *xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
+      xi = list_next (xi);
+      list_t *actual = (list_t *) list_value (xi);
+      for (listitem_t *ti = list_first (actual); ti; ti = list_next (ti)) {
+	hit_tile (h, (Tile *) list_value (ti), &tle->m);
+      }
+    }
+  }
+  LayoutBlob::searchFree (tiles);
+}
+
+/* elements overlapping w must be exactly the ones found */
+static void check_hits (const char *msg, int k, struct hits *h,
+			const Rectangle &w)
+{
+  for (int i=0; i < h->n; i++) {
+    if (h->seen[i] != (h->box[i].overlaps (w) ? 1 : 0)) {
+      printf ("array %d: %s %s element %d\n", k, msg,
+	      h->seen[i] ? "found" : "missed", i);
+      errors++;
+      return;
+    }
+  }
+}
+
+/*
+ * Arrayed (and mirrored/rotated) instances against a brute-force
+ * expansion of all their elements
+ */
+static void check_arrays (LayoutBlob **shapes, int n, int nq)
+{
+  struct hits h;
+
+  MALLOC (h.box, Rectangle, 25);
+  MALLOC (h.seen, char, 25);
+
+  for (int k=0; k < n; k++) {
+    LayoutBlob *b = shapes[rnd (NSHAPES)];
+    TransformMat m, pm;
+    int nx = 1 + rnd (5), ny = 1 + rnd (5);
+    Rectangle all;
+
+    switch (rnd (4)) {
+    case 1: m.mirrorLR (); break;
+    case 2: m.mirrorTB (); break;
+    case 3: m.mirror45 (); break;
+    default: break;
+    }
+    m.translate (rnd (20000) - 10000, rnd (20000) - 10000);
+
+    SubcellInst c (b, "a", &m);
+    c.mkArray (nx, ny);
+
+    h.n = nx*ny;
+    for (int iy=0; iy < ny; iy++) {
+      for (int ix=0; ix < nx; ix++) {
+	h.box[iy*nx + ix] = elem_box (b, &m, ix, iy);
+	all = all ^ h.box[iy*nx + ix];
+      }
+    }
+    if (!c.getBBox().contains (all)) {
+      printf ("array %d: bounding box misses elements\n", k);
+      errors++;
+    }
+
+    /* searchBBox, under a further transform */
+    long llx, lly, urx, ury;
+    if (rnd (2)) {
+      pm.mirrorLR ();
+    }
+    pm.translate (rnd (1000), rnd (1000));
+    c.searchBBox (&shape_net, &pm, &llx, &lly, &urx, &ury);
+    Rectangle pall = pm.applyBox (all);
+    if (llx != pall.llx() || lly != pall.lly() ||
+	urx != pall.urx() + 1 || ury != pall.ury() + 1) {
+      printf ("array %d: searchBBox (%ld,%ld)-(%ld,%ld), expected (%ld,%ld)-(%ld,%ld)\n",
+	      k, llx, lly, urx, ury, pall.llx(), pall.lly(),
+	      pall.urx() + 1, pall.ury() + 1);
+      errors++;
+    }
+
+    for (int q=0; q < nq; q++) {
+      Rectangle w;
+      int xlo, xhi, ylo, yhi;
+
+      w.setRect (all.llx() - 5000 + rnd (all.wx() + 10000),
+		 all.lly() - 5000 + rnd (all.wy() + 10000),
+		 1 + rnd (3000), 1 + rnd (3000));
+
+      /* elementRange */
+      int any = c.elementRange (&w, &xlo, &xhi, &ylo, &yhi);
+      for (int i=0; i < h.n; i++) {
+	int ix = i % nx, iy = i / nx;
+	h.seen[i] = (any && xlo <= ix && ix <= xhi && ylo <= iy && iy <= yhi);
+      }
+      check_hits ("elementRange", k, &h, w);
+
+      /* window search */
+      for (int i=0; i < h.n; i++) {
+	h.seen[i] = 0;
+      }
+      search_hits (&h, c.search (&shape_net, NULL, &w));
+      check_hits ("search", k, &h, w);
+
+      /* window visit */
+      for (int i=0; i < h.n; i++) {
+	h.seen[i] = 0;
+      }
+      c.visitTiles (BLOB_SEARCH_NET, &shape_net, 0, &h, visit_cb, NULL, &w);
+      check_hits ("visitTiles", k, &h, w);
+    }
+
+    /* no window: everything */
+    for (int i=0; i < h.n; i++) {
+      h.seen[i] = 0;
+    }
+    c.visitTiles (BLOB_SEARCH_NET, &shape_net, 0, &h, visit_cb);
+    check_hits ("visitTiles (all)", k, &h, all);
+  }
+  FREE (h.box);
+  FREE (h.seen);
+}
+
+static void usage (char *name)
+{
+  fprintf (stderr, "Usage: %s [-n <cells>] [-j <threads>]\n", name);
+  exit (1);
+}
+
+int main (int argc, char **argv)
+{
+  int ch;
+  int n = 20000;
+  int threads = 4;
+  LayoutBlob *shapes[NSHAPES];
+  SubcellInst **cells;
+  char *live;
+  double t0, t1, t2;
+
+  Act::Init (&argc, &argv, "layout:layout.conf");
+
+  while ((ch = getopt (argc, argv, "n:j:")) != -1) {
+    switch (ch) {
+    case 'n':
+      n = atoi (optarg);
+      break;
+    case 'j':
+      threads = atoi (optarg);
+      break;
+    default:
+      usage (argv[0]);
+      break;
+    }
+  }
+  if (n < 1 || threads < 1) {
+    usage (argv[0]);
+  }
+  srand (1);
+
+  for (int i=0; i < NSHAPES; i++) {
+    Layout *L = new Layout (NULL);
+    L->DrawMetal (0, 0, 0, 1 + rnd (3000), 1 + rnd (3000), &shape_net);
+    shapes[i] = new LayoutBlob (BLOB_BASE, L);
+  }
+
+  /* a mix of small and large cells, some mirrored */
+  MALLOC (cells, SubcellInst *, n);
+  MALLOC (live, char, n);
+  for (int i=0; i < n; i++) {
+    TransformMat m;
+    switch (rnd (4)) {
+    case 1: m.mirrorLR (); break;
+    case 2: m.mirrorTB (); break;
+    default: break;
+    }
+    m.translate (rnd (200000) - 100000, rnd (200000) - 100000);
+    cells[i] = new SubcellInst (shapes[rnd (NSHAPES)], "x", &m);
+    live[i] = 1;
+  }
+
+  LayerSubcell bulk, inc;
+
+  bulk.initGlobal ();
+  inc.initGlobal ();
+
+  t0 = now ();
+  bulk.build (cells, n, threads);
+  t1 = now ();
+  for (int i=0; i < n; i++) {
+    inc.addSubcell (cells[i]);
+  }
+  t2 = now ();
+  printf ("%d subcells: build %.3fs (%d threads), one at a time %.3fs\n",
+	  n, t1 - t0, threads, t2 - t1);
+
+  check_tree ("build", &bulk, n, cells, live, 200);
+  check_tree ("insert", &inc, n, cells, live, 200);
+
+  /* delete most of the cells and add some back, so that parts of
+     the tree get rebuilt */
+  for (int i=0; i < n; i++) {
+    if (rnd (4) != 0) {
+      bulk.delSubcell (cells[i]);
+      inc.delSubcell (cells[i]);
+      live[i] = 0;
+    }
+  }
+  check_tree ("delete/build", &bulk, n, cells, live, 200);
+  check_tree ("delete/insert", &inc, n, cells, live, 200);
+
+  for (int i=0; i < n; i++) {
+    if (!live[i] && rnd (2) == 0) {
+      bulk.addSubcell (cells[i]);
+      inc.addSubcell (cells[i]);
+      live[i] = 1;
+    }
+  }
+  check_tree ("reinsert/build", &bulk, n, cells, live, 200);
+  check_tree ("reinsert/insert", &inc, n, cells, live, 200);
+
+  for (int i=0; i < n; i++) {
+    if (live[i]) {
+      bulk.delSubcell (cells[i]);
+      inc.delSubcell (cells[i]);
+      live[i] = 0;
+    }
+  }
+  check_tree ("empty/build", &bulk, n, cells, live, 20);
+  check_tree ("empty/insert", &inc, n, cells, live, 20);
+
+  check_arrays (shapes, 500, 20);
+
+  if (errors) {
+    printf ("** %d errors\n", errors);
+    return 1;
+  }
+  printf ("ok\n");
+  return 0;
+}
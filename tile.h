@@ -143,6 +143,27 @@ public:
     return inXRange(x) && inYRange(y);
   }
 
+  bool overlaps (const Rectangle &r) const {
+    if (empty() || r.empty()) {
+      return false;
+    }
+    if (r.urx() < llx() || urx() < r.llx() ||
+	r.ury() < lly() || ury() < r.lly()) {
+      return false;
+    }
+    return true;
+  }
+
+  /* manhattan distance from (x,y) to the rectangle */
+  long distance (long x, long y) const {
+    long dx = 0, dy = 0;
+    if (x < llx()) dx = llx() - x;
+    else if (x > urx()) dx = x - urx();
+    if (y < lly()) dy = lly() - y;
+    else if (y > ury()) dy = y - ury();
+    return dx + dy;
+  }
+
   bool contains (const Rectangle &r) const {
     if (llx() <= r.llx() && lly() <= r.lly() &&
 	r.urx() <= urx() && r.ury() <= ury()) {